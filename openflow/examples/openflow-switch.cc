@@ -140,6 +140,7 @@ main (int argc, char *argv[])
       Ptr<ns3::ofi::LearningController> controller = CreateObject<ns3::ofi::LearningController> ();
       if (!timeout.IsZero ()) controller->SetAttribute ("ExpirationTime", TimeValue (timeout));
       swtch.Install (switchNode, switchDevices, controller);
+      controller->FinalizeTopology ();
     }
 
   // Add internet stack to the terminals
@@ -132,6 +132,8 @@ main (int argc, char *argv[])
    ofSwitch[i].Install (switchNode, switchDevices[i], controller);
      
   }
+  // Every switch is registered; compute the routes once.
+  controller->FinalizeTopology ();
  
   
   // PointToPointHelper pointToPoint;
@@ -149,6 +149,7 @@ main (int argc, char *argv[])
   switch1.Install (switchNode1, switchDevices1, controller);
   switch2.Install (switchNode2, switchDevices2, controller);
   switch3.Install (switchNode3, switchDevices3, controller);
+  controller->FinalizeTopology ();
 
 
   // Add internet stack to the terminals
@@ -149,7 +149,9 @@ main (int argc, char *argv[])
   Ptr<Node> switchNode2 = csmaSwitch.Get (1);
   OpenFlowSwitchHelper switch1,switch2;
 
-  // Creating the controller
+  // Creating the controller. It processes messages instantly unless given a
+  // processing time, e.g. with
+  // --ns3::ofi::Controller::ProcessingTime=ns3::ConstantRandomVariable[Constant=0.001]
   Ptr<ns3::ofi::LearningController> controller = CreateObject<ns3::ofi::LearningController> ();
    if (!timeout.IsZero ()) controller->SetAttribute ("ExpirationTime", TimeValue (timeout));
     
@@ -158,6 +160,7 @@ main (int argc, char *argv[])
   
   //Linking switch1 with controller
   switch2.Install (switchNode2, switchDevices2, controller);
+  controller->FinalizeTopology ();
  
   InternetStackHelper internet;
   internet.Install (terminals);
@@ -209,6 +212,7 @@ main (int argc, char *argv[])
   //
   NS_LOG_INFO ("Run Simulation.");
   Simulator::Run ();
+  NS_LOG_INFO ("Controller dropped " << controller->GetQueueDrops () << " messages.");
   Simulator::Destroy ();
   NS_LOG_INFO ("Done.");
   #else
@@ -159,6 +159,8 @@ main (int argc, char *argv[])
   
   //Linking switch1 with controller1
   switch2.Install (switchNode2, switchDevices2, controller2);
+  controller1->FinalizeTopology ();
+  controller2->FinalizeTopology ();
 
 
 
@@ -61,6 +61,11 @@ public:
    * switch, and sets up a controller connection using the provided
    * Controller.
    *
+   * The switch and the links added with addDeviceSwitch and addDeviceNode
+   * are registered with the controller, which only records them; call
+   * Controller::FinalizeTopology once the last switch is installed so
+   * the routes are computed once for the whole topology.
+   *
    * \param node The node to install the device in
    * \param c Container of NetDevices to add as switch ports
    * \param controller The controller connection.
@@ -0,0 +1,193 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifdef NS3_OPENFLOW
+
+#include "openflow-control-link.h"
+#include "ns3/log.h"
+#include "ns3/simulator.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("OpenFlowControlLink");
+
+namespace ofi {
+
+ControlLink::ControlLink ()
+  : m_delay (Seconds (0)),
+    m_rate (DataRate (0)),
+    m_maxMessages (0),
+    m_delivered (0),
+    m_drops (0),
+    m_queueingDelay (Seconds (0))
+{
+}
+
+ControlLink::~ControlLink ()
+{
+  Clear ();
+}
+
+void
+ControlLink::SetDeliverCallback (DeliverCallback cb)
+{
+  m_deliver = cb;
+}
+
+void
+ControlLink::SetDelay (Time delay)
+{
+  m_delay = delay;
+}
+
+Time
+ControlLink::GetDelay (void) const
+{
+  return m_delay;
+}
+
+void
+ControlLink::SetDataRate (DataRate rate)
+{
+  m_rate = rate;
+}
+
+DataRate
+ControlLink::GetDataRate (void) const
+{
+  return m_rate;
+}
+
+void
+ControlLink::SetMaxMessages (uint32_t max)
+{
+  m_maxMessages = max;
+}
+
+uint32_t
+ControlLink::GetMaxMessages (void) const
+{
+  return m_maxMessages;
+}
+
+bool
+ControlLink::IsInstant (void) const
+{
+  return m_delay.IsZero () && m_rate.GetBitRate () == 0;
+}
+
+bool
+ControlLink::Send (const void *msg, size_t length)
+{
+  if (m_maxMessages != 0 && m_queue.size () >= m_maxMessages)
+    {
+      NS_LOG_DEBUG ("Control link queue full; dropping a message of " << length << " bytes");
+      m_drops++;
+      return false;
+    }
+
+  m_queue.push_back (Message ());
+  Message& message = m_queue.back ();
+  message.data.assign ((const uint8_t *)msg, (const uint8_t *)msg + length);
+  message.enqueued = Simulator::Now ();
+  if (m_queue.size () == 1)
+    {
+      StartTransmission ();
+    }
+  return true;
+}
+
+void
+ControlLink::StartTransmission (void)
+{
+  Message& message = m_queue.front ();
+  m_queueingDelay += Simulator::Now () - message.enqueued;
+  if (m_rate.GetBitRate () == 0)
+    {
+      TransmitComplete ();
+      return;
+    }
+  m_transmitEvent = Simulator::Schedule (m_rate.CalculateBytesTxTime (message.data.size ()),
+                                         &ControlLink::TransmitComplete, this);
+}
+
+void
+ControlLink::TransmitComplete (void)
+{
+  m_inFlight.push_back (Message ());
+  m_inFlight.back ().data.swap (m_queue.front ().data);
+  m_inFlight.back ().arrival = Simulator::Schedule (m_delay, &ControlLink::Deliver, this);
+  m_queue.pop_front ();
+  if (!m_queue.empty ())
+    {
+      StartTransmission ();
+    }
+}
+
+void
+ControlLink::Deliver (void)
+{
+  // The callback may send on this link again; take the message off first.
+  std::vector<uint8_t> data;
+  data.swap (m_inFlight.front ().data);
+  m_inFlight.pop_front ();
+  m_delivered++;
+  if (!m_deliver.IsNull ())
+    {
+      m_deliver (data.empty () ? 0 : &data[0], data.size ());
+    }
+}
+
+void
+ControlLink::Clear (void)
+{
+  Simulator::Cancel (m_transmitEvent);
+  for (std::deque<Message>::iterator it = m_inFlight.begin (); it != m_inFlight.end (); it++)
+    {
+      Simulator::Cancel (it->arrival);
+    }
+  m_queue.clear ();
+  m_inFlight.clear ();
+}
+
+uint64_t
+ControlLink::GetDelivered (void) const
+{
+  return m_delivered;
+}
+
+uint64_t
+ControlLink::GetDrops (void) const
+{
+  return m_drops;
+}
+
+Time
+ControlLink::GetQueueingDelay (void) const
+{
+  return m_queueingDelay;
+}
+
+uint32_t
+ControlLink::GetQueueLength (void) const
+{
+  return m_queue.size ();
+}
+
+} // namespace ofi
+
+} // namespace ns3
+
+#endif // NS3_OPENFLOW
@@ -0,0 +1,132 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef OPENFLOW_CONTROL_LINK_H
+#define OPENFLOW_CONTROL_LINK_H
+
+#include "ns3/callback.h"
+#include "ns3/data-rate.h"
+#include "ns3/event-id.h"
+#include "ns3/nstime.h"
+
+#include <deque>
+#include <vector>
+
+namespace ns3 {
+
+namespace ofi {
+
+/**
+ * \ingroup openflow
+ * \brief One direction of the out-of-band control connection between a
+ * switch and its controller.
+ *
+ * Messages are copied in, sent one after the other at the data rate of the
+ * link, and delivered once the propagation delay has passed. A message that
+ * finds the queue full is dropped. A link with neither delay nor data rate
+ * is instant: its owner hands messages over directly, as if there was no link.
+ */
+class ControlLink
+{
+public:
+  /// Callback delivering a message at the far end of the link.
+  typedef Callback<void, const uint8_t *, size_t> DeliverCallback;
+
+  ControlLink ();
+  ~ControlLink ();
+
+  /// \param cb The callback messages are delivered to.
+  void SetDeliverCallback (DeliverCallback cb);
+
+  /// \param delay The one-way propagation delay.
+  void SetDelay (Time delay);
+
+  /// \return The one-way propagation delay.
+  Time GetDelay (void) const;
+
+  /// \param rate The data rate messages are sent at; 0 for no serialization delay.
+  void SetDataRate (DataRate rate);
+
+  /// \return The data rate messages are sent at.
+  DataRate GetDataRate (void) const;
+
+  /// \param max Number of messages the link holds while they wait or are sent; 0 for no limit.
+  void SetMaxMessages (uint32_t max);
+
+  /// \return Number of messages the link holds while they wait or are sent.
+  uint32_t GetMaxMessages (void) const;
+
+  /// \return true if messages cross the link without delay.
+  bool IsInstant (void) const;
+
+  /**
+   * Queue a message for delivery.
+   *
+   * \param msg The message; copied.
+   * \param length Length of the message.
+   * \return false if the queue was full and the message was dropped.
+   */
+  bool Send (const void *msg, size_t length);
+
+  /// Drop every queued and in flight message, without counting them as drops.
+  void Clear (void);
+
+  /// \return Number of messages delivered.
+  uint64_t GetDelivered (void) const;
+
+  /// \return Number of messages dropped because the queue was full.
+  uint64_t GetDrops (void) const;
+
+  /// \return Total time delivered messages waited in the queue before being sent.
+  Time GetQueueingDelay (void) const;
+
+  /// \return Number of messages waiting or being sent.
+  uint32_t GetQueueLength (void) const;
+
+private:
+  /// A message on the link.
+  struct Message
+  {
+    std::vector<uint8_t> data;          ///< Copy of the message.
+    Time enqueued;                      ///< Time the message was queued.
+    EventId arrival;                    ///< Delivery event, once the message is sent.
+  };
+
+  /// Send the message at the head of the queue.
+  void StartTransmission (void);
+
+  /// The head of the queue is sent; it starts propagating.
+  void TransmitComplete (void);
+
+  /// The oldest message in flight arrives.
+  void Deliver (void);
+
+  DeliverCallback m_deliver;            ///< Callback at the far end.
+  Time m_delay;                         ///< One-way propagation delay.
+  DataRate m_rate;                      ///< Data rate; 0 for no serialization delay.
+  uint32_t m_maxMessages;               ///< Queue limit; 0 for none.
+  std::deque<Message> m_queue;          ///< Messages waiting, the one being sent first.
+  std::deque<Message> m_inFlight;       ///< Messages propagating, in arrival order.
+  EventId m_transmitEvent;              ///< End of the current transmission.
+  uint64_t m_delivered;                 ///< Messages delivered.
+  uint64_t m_drops;                     ///< Messages dropped.
+  Time m_queueingDelay;                 ///< Total queueing delay of the messages sent.
+};
+
+} // namespace ofi
+
+} // namespace ns3
+
+#endif /* OPENFLOW_CONTROL_LINK_H */
@@ -0,0 +1,145 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifdef NS3_OPENFLOW
+
+#include "openflow-flow-timer-wheel.h"
+
+#include <algorithm>
+
+namespace ns3 {
+
+namespace ofi {
+
+FlowTimerWheel::FlowTimerWheel ()
+  : m_current (0),
+    m_size (0)
+{
+}
+
+void
+FlowTimerWheel::Schedule (uint64_t expires, sw_flow *flow, uint64_t serial)
+{
+  const uint64_t horizon = (uint64_t)1 << (BITS * LEVELS);
+  Timer timer;
+  timer.flow = flow;
+  timer.serial = serial;
+  timer.expires = std::min (std::max (expires, m_current + 1), m_current + horizon - 1);
+  Insert (timer);
+  m_size++;
+}
+
+void
+FlowTimerWheel::Insert (const Timer& timer)
+{
+  uint64_t delta = timer.expires - m_current;
+  unsigned int level = 0;
+  while (level < LEVELS - 1 && delta >= (uint64_t)1 << (BITS * (level + 1)))
+    {
+      level++;
+    }
+  m_slots[level][(timer.expires >> (BITS * level)) & (SLOTS - 1)].push_back (timer);
+}
+
+void
+FlowTimerWheel::Cascade (unsigned int level)
+{
+  std::vector<Timer> timers;
+  timers.swap (m_slots[level][(m_current >> (BITS * level)) & (SLOTS - 1)]);
+  for (std::vector<Timer>::const_iterator t = timers.begin (); t != timers.end (); t++)
+    {
+      Insert (*t);
+    }
+}
+
+void
+FlowTimerWheel::Advance (uint64_t tick, std::vector<Timer>& due)
+{
+  while (m_current < tick)
+    {
+      if (m_size == 0)
+        {
+          // Nothing to fire or move down; an empty wheel doesn't have to turn tick by tick.
+          m_current = tick;
+          break;
+        }
+
+      m_current++;
+      // Higher levels first, so their timers can still land in the slots cascaded below.
+      for (unsigned int level = LEVELS - 1; level > 0; level--)
+        {
+          if ((m_current & (((uint64_t)1 << (BITS * level)) - 1)) == 0)
+            {
+              Cascade (level);
+            }
+        }
+
+      std::vector<Timer>& slot = m_slots[0][m_current & (SLOTS - 1)];
+      m_size -= slot.size ();
+      due.insert (due.end (), slot.begin (), slot.end ());
+      slot.clear ();
+    }
+}
+
+uint64_t
+FlowTimerWheel::GetNextTick (void) const
+{
+  if (m_size == 0)
+    {
+      return 0;
+    }
+
+  // A level 0 slot before the wheel wraps, or else the wrap itself, where timers come down.
+  uint64_t tick = m_current + 1;
+  for (; (tick & (SLOTS - 1)) != 0; tick++)
+    {
+      if (!m_slots[0][tick & (SLOTS - 1)].empty ())
+        {
+          return tick;
+        }
+    }
+  return tick;
+}
+
+uint64_t
+FlowTimerWheel::GetCurrentTick (void) const
+{
+  return m_current;
+}
+
+size_t
+FlowTimerWheel::GetSize (void) const
+{
+  return m_size;
+}
+
+void
+FlowTimerWheel::Clear (void)
+{
+  for (unsigned int level = 0; level < LEVELS; level++)
+    {
+      for (unsigned int slot = 0; slot < SLOTS; slot++)
+        {
+          m_slots[level][slot].clear ();
+        }
+    }
+  m_size = 0;
+}
+
+} // namespace ofi
+
+} // namespace ns3
+
+#endif // NS3_OPENFLOW
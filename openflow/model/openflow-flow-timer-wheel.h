@@ -0,0 +1,107 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef OPENFLOW_FLOW_TIMER_WHEEL_H
+#define OPENFLOW_FLOW_TIMER_WHEEL_H
+
+#include "openflow-interface.h"
+
+#include <vector>
+
+namespace ns3 {
+
+namespace ofi {
+
+/**
+ * \ingroup openflow
+ * \brief Hierarchical timer wheel holding the flow expiration timers of a switch.
+ *
+ * Time is counted in ticks. Level 0 has one slot per tick for the next
+ * SLOTS ticks; each higher level has slots SLOTS times as wide. A timer goes
+ * into the lowest level its expiry fits in and moves down a level each time
+ * the wheel turns past the start of its slot, so adding a timer and firing one
+ * cost O(1), and advancing the wheel only touches the timers that are due.
+ *
+ * Timers are never removed; whoever owns one tells a stale timer apart by its
+ * serial when it fires.
+ */
+class FlowTimerWheel
+{
+public:
+  /// A flow expiration timer.
+  struct Timer
+  {
+    sw_flow *flow;      ///< The flow to check once the timer fires.
+    uint64_t serial;    ///< Serial the flow was armed under.
+    uint64_t expires;   ///< Tick the timer fires at.
+  };
+
+  FlowTimerWheel ();
+
+  /**
+   * Arm a timer. A tick that is already due fires on the next tick; a tick
+   * beyond the reach of the wheel fires at its horizon, and the owner re-arms it.
+   *
+   * \param expires Tick the timer fires at.
+   * \param flow The flow to check once the timer fires.
+   * \param serial Serial the flow was armed under.
+   */
+  void Schedule (uint64_t expires, sw_flow *flow, uint64_t serial);
+
+  /**
+   * Turn the wheel to the given tick, collecting every timer due by then.
+   * An empty wheel jumps straight to the tick.
+   *
+   * \param tick The current tick.
+   * \param due Filled with the timers that fired.
+   */
+  void Advance (uint64_t tick, std::vector<Timer>& due);
+
+  /**
+   * \return The next tick the wheel has to be advanced to, either because a
+   * timer fires or because timers move down a level; 0 if the wheel is empty.
+   */
+  uint64_t GetNextTick (void) const;
+
+  /// \return The tick the wheel was last advanced to.
+  uint64_t GetCurrentTick (void) const;
+
+  /// \return Number of armed timers, stale ones included.
+  size_t GetSize (void) const;
+
+  /// Drop every timer.
+  void Clear (void);
+
+private:
+  static const unsigned int LEVELS = 4;                  ///< Number of levels.
+  static const unsigned int BITS = 6;                    ///< log2 of the number of slots per level.
+  static const unsigned int SLOTS = 1 << BITS;           ///< Number of slots per level.
+
+  /// Put a timer in the slot its expiry falls in.
+  void Insert (const Timer& timer);
+
+  /// Move the timers of the current slot of a level down the wheel.
+  void Cascade (unsigned int level);
+
+  std::vector<Timer> m_slots[LEVELS][SLOTS];             ///< Timers by level and slot.
+  uint64_t m_current;                                    ///< Tick the wheel was last advanced to.
+  size_t m_size;                                         ///< Number of armed timers.
+};
+
+} // namespace ofi
+
+} // namespace ns3
+
+#endif /* OPENFLOW_FLOW_TIMER_WHEEL_H */
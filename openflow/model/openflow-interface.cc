@@ -19,6 +19,15 @@
 
 #include "openflow-interface.h"
 #include "openflow-switch-net-device.h"
+#include "ns3/boolean.h"
+#include "ns3/channel.h"
+#include "ns3/double.h"
+#include "ns3/enum.h"
+#include "ns3/pointer.h"
+#include "ns3/uinteger.h"
+#include "ns3/trace-source-accessor.h"
+
+#include <algorithm>
 
 namespace ns3 {
 
@@ -49,6 +58,10 @@ Stats::Stats (ofp_stats_types _type, size_t body_len)
       break;
     case OFPST_PORT_TABLE:
       break;
+    case OFPST_VENDOR:
+      min_body = sizeof(uint32_t);
+      max_body = std::numeric_limits<size_t>::max ();
+      break;
     default:
       NS_LOG_ERROR ("received stats request of unknown type " << type);
       return; // -EINVAL;
@@ -79,7 +92,7 @@ Stats::DoInit (const void *body, int body_len, void **state)
     case OFPST_PORT_TABLE:
       return 0;
     case OFPST_VENDOR:
-      return 0;
+      return VendorStatsInit (body, body_len, state);
     }
 
   return 0;
@@ -103,7 +116,7 @@ Stats::DoDump (Ptr<OpenFlowSwitchNetDevice> swtch, void *state, ofpbuf *buffer)
     case OFPST_PORT_TABLE:
       return PortTableStatsDump (swtch, state, buffer);
     case OFPST_VENDOR:
-      return 0;
+      return VendorStatsDump (swtch, state, buffer);
     }
 
   return 0;
@@ -202,7 +215,7 @@ Stats::FlowStatsDump (Ptr<OpenFlowSwitchNetDevice> swtch, FlowStatsState* s, ofp
   flow_extract_match (&match_key, &s->rq.match);
 
   s->buffer = buffer;
-  s->now = time_now ();
+  s->now = FlowTimeNow ();
   while (s->table_idx < swtch->GetChain ()->n_tables
          && (s->rq.table_id == 0xff || s->rq.table_id == s->table_idx))
     {
@@ -303,6 +316,26 @@ Stats::PortTableStatsDump (Ptr<OpenFlowSwitchNetDevice> swtch, void *state, ofpb
   return 0;
 }
 
+int
+Stats::VendorStatsInit (const void *body, int body_len, void **state)
+{
+  if (body_len < (int)sizeof(uint32_t) || ntohl (*(const uint32_t*)body) != OFI_VENDOR_ID)
+    {
+      return -EINVAL;
+    }
+  return 0;
+}
+
+int
+Stats::VendorStatsDump (Ptr<OpenFlowSwitchNetDevice> swtch, void *state, ofpbuf *buffer)
+{
+  ofi_packet_in_stats *ops = (ofi_packet_in_stats*)ofpbuf_put_zeros (buffer, sizeof *ops);
+  ops->vendor = htonl (OFI_VENDOR_ID);
+  ops->packet_in_count = htonll (swtch->GetPacketIns ());
+  ops->meter_drop_count = htonll (swtch->GetPacketInMeterDrops ());
+  return 0;
+}
+
 int
 Stats::PortStatsInit (const void *body, int body_len, void **state)
 {
@@ -650,6 +683,69 @@ EricssonAction::Execute (er_action_type type, ofpbuf *buffer, const sw_flow_key
     }
 }
 
+/// \return The mask of a network address with the given number of wildcarded low bits.
+static uint32_t
+MakeNetworkMask (uint32_t n_wild_bits)
+{
+  n_wild_bits &= (1u << OFPFW_NW_SRC_BITS) - 1;
+  return n_wild_bits < 32 ? htonl (~((1u << n_wild_bits) - 1)) : 0;
+}
+
+FlowSpec::FlowSpec ()
+  : command (OFPFC_ADD),
+    priority (OFP_DEFAULT_PRIORITY),
+    idle_timeout (OFP_FLOW_PERMANENT),
+    hard_timeout (OFP_FLOW_PERMANENT),
+    buffer_id (-1),
+    out_port (OFPP_NONE),
+    actions (0),
+    actions_len (0)
+{
+  memset (&key, 0, sizeof key);
+}
+
+void
+FlowSpec::SetMatch (const flow& f, uint32_t wildcards)
+{
+  key.flow = f;
+  key.flow.reserved = 0;
+  key.wildcards = wildcards & OFPFW_ALL;
+  key.nw_src_mask = MakeNetworkMask (key.wildcards >> OFPFW_NW_SRC_SHIFT);
+  key.nw_dst_mask = MakeNetworkMask (key.wildcards >> OFPFW_NW_DST_SHIFT);
+}
+
+TokenBucket::TokenBucket ()
+  : m_tokens (-1)
+{
+}
+
+bool
+TokenBucket::Take (double rate, uint32_t burst)
+{
+  if (rate <= 0)
+    {
+      return true;
+    }
+
+  Time now = Simulator::Now ();
+  if (m_tokens < 0)
+    {
+      m_tokens = burst;
+    }
+  else
+    {
+      m_tokens = std::min ((double)burst, m_tokens + (now - m_lastFill).GetSeconds () * rate);
+    }
+  m_lastFill = now;
+
+  if (m_tokens < 1)
+    {
+      return false;
+    }
+  m_tokens -= 1;
+  return true;
+}
+
 /* static */
 TypeId
 Controller::GetTypeId (void)
@@ -658,15 +754,267 @@ Controller::GetTypeId (void)
     .SetParent<Object> ()
     .SetGroupName ("OpenFlow")
     .AddConstructor<Controller> ()
+    .AddAttribute ("NativeControl",
+                   "Hand flow mods and packet outs to the switches as host order structures "
+                   "instead of encoding them as OpenFlow messages. They skip the control connection "
+                   "delay and queue too.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&Controller::m_nativeControl),
+                   MakeBooleanChecker ())
+    .AddAttribute ("ProcessingTime",
+                   "Seconds the controller takes to process a message from a switch. "
+                   "Without one, messages are processed as soon as they arrive.",
+                   PointerValue (),
+                   MakePointerAccessor (&Controller::m_processingTime),
+                   MakePointerChecker<RandomVariableStream> ())
+    .AddAttribute ("QueueSize",
+                   "Messages that can wait in the input queue while another one is processed; 0 for no limit.",
+                   UintegerValue (100),
+                   MakeUintegerAccessor (&Controller::m_queueSize),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("QueueDiscipline",
+                   "How the input queue orders waiting messages and picks the ones to drop.",
+                   EnumValue (TAIL_DROP),
+                   MakeEnumAccessor (&Controller::m_queueDiscipline),
+                   MakeEnumChecker (TAIL_DROP, "TailDrop",
+                                    PRIORITY, "Priority"))
+    .AddAttribute ("PacketInRate",
+                   "Packet ins per second the controller admits from all of its switches together; "
+                   "the ones over it are dropped before they reach the input queue. 0 for no limit.",
+                   DoubleValue (0),
+                   MakeDoubleAccessor (&Controller::m_packetInRate),
+                   MakeDoubleChecker<double> (0))
+    .AddAttribute ("PacketInBurst",
+                   "Packet ins the controller admits at once, before PacketInRate limits them.",
+                   UintegerValue (100),
+                   MakeUintegerAccessor (&Controller::m_packetInBurst),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddTraceSource ("QueueDepth",
+                     "Number of messages waiting in the input queue.",
+                     MakeTraceSourceAccessor (&Controller::m_queueDepth),
+                     "ns3::TracedValueCallback::Uint32")
+    .AddTraceSource ("SojournTime",
+                     "Time a message spent waiting and being processed, reported when it is done.",
+                     MakeTraceSourceAccessor (&Controller::m_sojournTrace),
+                     "ns3::Time::TracedCallback")
+    .AddTraceSource ("Drop",
+                     "A message was dropped from the input queue, or a packet in refused admission.",
+                     MakeTraceSourceAccessor (&Controller::m_dropTrace),
+                     "ns3::ofi::Controller::DropTracedCallback")
     ;
   return tid;
 }
 
+Controller::Controller ()
+  : m_nativeControl (false),
+    m_queueSize (100),
+    m_queueDiscipline (TAIL_DROP),
+    m_busy (false),
+    m_queueDrops (0),
+    m_packetInRate (0),
+    m_packetInBurst (100),
+    m_admissionDrops (0),
+    m_queueDepth (0)
+{
+  m_current.buffer = 0;
+}
+
 Controller::~Controller ()
 {
   m_switches.clear ();
 }
 
+void
+Controller::DoDispose (void)
+{
+  Simulator::Cancel (m_processingEvent);
+  if (m_busy)
+    {
+      ofpbuf_delete (m_current.buffer);
+      m_current.buffer = 0;
+      m_current.swtch = 0;
+      m_busy = false;
+    }
+  for (std::deque<QueuedMessage>::iterator it = m_urgent.begin (); it != m_urgent.end (); it++)
+    {
+      ofpbuf_delete (it->buffer);
+    }
+  for (std::deque<QueuedMessage>::iterator it = m_queue.begin (); it != m_queue.end (); it++)
+    {
+      ofpbuf_delete (it->buffer);
+    }
+  m_urgent.clear ();
+  m_queue.clear ();
+  m_processingTime = 0;
+  m_typeProcessingTime.clear ();
+  m_switches.clear ();
+  Object::DoDispose ();
+}
+
+void
+Controller::SetProcessingTime (uint8_t type, Ptr<RandomVariableStream> time)
+{
+  m_typeProcessingTime[type] = time;
+}
+
+int64_t
+Controller::AssignStreams (int64_t stream)
+{
+  int64_t assigned = 0;
+  if (m_processingTime != 0)
+    {
+      m_processingTime->SetStream (stream + assigned++);
+    }
+  for (ProcessingTimes_t::iterator it = m_typeProcessingTime.begin (); it != m_typeProcessingTime.end (); it++)
+    {
+      it->second->SetStream (stream + assigned++);
+    }
+  return assigned;
+}
+
+uint32_t
+Controller::GetQueueLength (void) const
+{
+  return m_urgent.size () + m_queue.size ();
+}
+
+uint64_t
+Controller::GetQueueDrops (void) const
+{
+  return m_queueDrops;
+}
+
+uint64_t
+Controller::GetAdmissionDrops (void) const
+{
+  return m_admissionDrops;
+}
+
+bool
+Controller::IsInstant (void) const
+{
+  return m_processingTime == 0 && m_typeProcessingTime.empty ();
+}
+
+Time
+Controller::GetProcessingTime (uint8_t type)
+{
+  ProcessingTimes_t::iterator it = m_typeProcessingTime.find (type);
+  if (it != m_typeProcessingTime.end ())
+    {
+      return Seconds (it->second->GetValue ());
+    }
+  return m_processingTime != 0 ? Seconds (m_processingTime->GetValue ()) : Seconds (0);
+}
+
+void
+Controller::EnqueueFromSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer)
+{
+  if (m_packetInRate > 0 && GetPacketType (buffer) == OFPT_PACKET_IN
+      && !m_packetInMeter.Take (m_packetInRate, m_packetInBurst))
+    {
+      NS_LOG_DEBUG ("Packet in over the admission rate; dropping it");
+      m_admissionDrops++;
+      m_dropTrace (swtch, OFPT_PACKET_IN);
+      return;
+    }
+
+  if (IsInstant () && !m_busy)
+    {
+      HandleFromSwitch (swtch, buffer);
+      return;
+    }
+
+  QueuedMessage message;
+  message.swtch = swtch;
+  message.buffer = 0;
+  message.type = GetPacketType (buffer);
+  message.arrival = Simulator::Now ();
+
+  bool urgent = m_queueDiscipline == PRIORITY && message.type != OFPT_PACKET_IN;
+  if (m_queueSize != 0 && GetQueueLength () >= m_queueSize)
+    {
+      if (!urgent || m_queue.empty ())
+        {
+          DropMessage (message);
+          return;
+        }
+      // Make room by giving up on the newest packet in.
+      DropMessage (m_queue.back ());
+      ofpbuf_delete (m_queue.back ().buffer);
+      m_queue.pop_back ();
+    }
+
+  message.buffer = ofpbuf_clone (buffer);
+  if (urgent)
+    {
+      m_urgent.push_back (message);
+    }
+  else
+    {
+      m_queue.push_back (message);
+    }
+
+  if (!m_busy)
+    {
+      StartProcessing ();
+    }
+  UpdateQueueDepth ();
+}
+
+void
+Controller::StartProcessing (void)
+{
+  std::deque<QueuedMessage>& queue = m_urgent.empty () ? m_queue : m_urgent;
+  m_current = queue.front ();
+  queue.pop_front ();
+  m_busy = true;
+  m_processingEvent = Simulator::Schedule (GetProcessingTime (m_current.type), &Controller::ProcessingComplete, this);
+}
+
+void
+Controller::ProcessingComplete (void)
+{
+  // Start on the next message first; ReceiveFromSwitch may make the switch send more.
+  QueuedMessage message = m_current;
+  m_current.swtch = 0;
+  m_current.buffer = 0;
+  m_busy = false;
+  if (GetQueueLength () > 0)
+    {
+      StartProcessing ();
+      UpdateQueueDepth ();
+    }
+
+  m_sojournTrace (Simulator::Now () - message.arrival);
+  HandleFromSwitch (message.swtch, message.buffer);
+  ofpbuf_delete (message.buffer);
+}
+
+void
+Controller::HandleFromSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer)
+{
+  if (GetPacketType (buffer) == OFPT_PORT_STATUS && buffer->size >= sizeof(ofp_port_status))
+    {
+      PortStatusChanged (swtch, (const ofp_port_status*)buffer->data);
+    }
+  ReceiveFromSwitch (swtch, buffer);
+}
+
+void
+Controller::DropMessage (QueuedMessage& message)
+{
+  NS_LOG_DEBUG ("Controller input queue full; dropping a message of type " << (int)message.type);
+  m_queueDrops++;
+  m_dropTrace (message.swtch, message.type);
+}
+
+void
+Controller::UpdateQueueDepth (void)
+{
+  m_queueDepth = GetQueueLength ();
+}
+
 void
 Controller::AddSwitch (Ptr<OpenFlowSwitchNetDevice> swtch)
 {
@@ -692,10 +1040,82 @@ Controller::SendToSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, void * msg, size_t
   swtch->ForwardControlInput (msg, length);
 }
 
+void
+Controller::SendFlow (Ptr<OpenFlowSwitchNetDevice> swtch, const FlowSpec& spec)
+{
+  if (m_nativeControl)
+    {
+      if (m_switches.find (swtch) == m_switches.end ())
+        {
+          NS_LOG_ERROR ("Can't send to this switch, not registered to the Controller.");
+          return;
+        }
+      swtch->InstallFlow (spec);
+      return;
+    }
+
+  sw_flow_key key = spec.key;
+  key.wildcards = htonl (spec.key.wildcards);
+  ofp_flow_mod* ofm = BuildFlow (key, spec.buffer_id, spec.command, (void*)spec.actions, spec.actions_len, spec.idle_timeout, spec.hard_timeout);
+  ofm->priority = htons (spec.priority);
+  ofm->out_port = spec.out_port;   // Output action ports are stored unconverted, so match them the same way.
+  SendToSwitch (swtch, ofm, ntohs (ofm->header.length));
+  free (ofm);
+}
+
+void
+Controller::SendPacketOut (Ptr<OpenFlowSwitchNetDevice> swtch, uint32_t buffer_id, uint16_t in_port, const void* acts, size_t actions_len)
+{
+  if (m_nativeControl)
+    {
+      if (m_switches.find (swtch) == m_switches.end ())
+        {
+          NS_LOG_ERROR ("Can't send to this switch, not registered to the Controller.");
+          return;
+        }
+      swtch->SendPacketOut (buffer_id, in_port, (const ofp_action_header*)acts, actions_len);
+      return;
+    }
+
+  ofp_packet_out* opo = BuildPacketOut (buffer_id, in_port, (void*)acts, actions_len);
+  SendToSwitch (swtch, opo, ntohs (opo->header.length));
+  free (opo);
+}
+
+void
+Controller::SendPacketOut (Ptr<OpenFlowSwitchNetDevice> swtch, Ptr<Packet> packet, uint16_t protocol, Mac48Address src, Mac48Address dst,
+                           uint16_t in_port, const void* acts, size_t actions_len)
+{
+  if (m_nativeControl)
+    {
+      if (m_switches.find (swtch) == m_switches.end ())
+        {
+          NS_LOG_ERROR ("Can't send to this switch, not registered to the Controller.");
+          return;
+        }
+      swtch->SendPacketOut (packet, protocol, src, dst, in_port, (const ofp_action_header*)acts, actions_len);
+      return;
+    }
+
+  EthernetHeader eth (false);
+  eth.SetSource (src);
+  eth.SetDestination (dst);
+  eth.SetLengthType (protocol);
+  Ptr<Packet> frame = packet->Copy ();
+  frame->AddHeader (eth);
+  std::vector<uint8_t> data (frame->GetSize ());
+  frame->CopyData (&data[0], data.size ());
+
+  ofp_packet_out* opo = BuildPacketOut (-1, in_port, (void*)acts, actions_len, &data[0], data.size ());
+  SendToSwitch (swtch, opo, ntohs (opo->header.length));
+  free (opo);
+}
+
 ofp_flow_mod*
 Controller::BuildFlow (sw_flow_key key, uint32_t buffer_id, uint16_t command, void* acts, size_t actions_len, int idle_timeout, int hard_timeout)
 {
   ofp_flow_mod* ofm = (ofp_flow_mod*)malloc (sizeof(ofp_flow_mod) + actions_len);
+  memset (ofm, 0, sizeof(ofp_flow_mod));
   ofm->header.version = OFP_VERSION;
   ofm->header.type = OFPT_FLOW_MOD;
   ofm->header.length = htons (sizeof(ofp_flow_mod) + actions_len);
@@ -703,7 +1123,8 @@ Controller::BuildFlow (sw_flow_key key, uint32_t buffer_id, uint16_t command, vo
   ofm->idle_timeout = htons (idle_timeout);
   ofm->hard_timeout = htons (hard_timeout);
   ofm->buffer_id = htonl (buffer_id);
-  ofm->priority = OFP_DEFAULT_PRIORITY;
+  ofm->priority = htons (OFP_DEFAULT_PRIORITY);
+  ofm->out_port = htons (OFPP_NONE);
   memcpy (ofm->actions,acts,actions_len);
 
   ofm->match.wildcards = key.wildcards;                                 // Wildcard fields
@@ -718,11 +1139,30 @@ Controller::BuildFlow (sw_flow_key key, uint32_t buffer_id, uint16_t command, vo
   ofm->match.tp_src = key.flow.tp_src;                                  // TCP/UDP source port
   ofm->match.tp_dst = key.flow.tp_dst;                                  // TCP/UDP destination port
   ofm->match.mpls_label1 = key.flow.mpls_label1;                        // Top of label stack htonl(MPLS_INVALID_LABEL);
-  ofm->match.mpls_label2 = key.flow.mpls_label1;                        // Second label (if available) htonl(MPLS_INVALID_LABEL);
+  ofm->match.mpls_label2 = key.flow.mpls_label2;                        // Second label (if available) htonl(MPLS_INVALID_LABEL);
 
   return ofm;
 }
 
+ofp_packet_out*
+Controller::BuildPacketOut (uint32_t buffer_id, uint16_t in_port, void* acts, size_t actions_len, const uint8_t* data, size_t data_len)
+{
+  ofp_packet_out* opo = (ofp_packet_out*)malloc (sizeof(ofp_packet_out) + actions_len + data_len);
+  memset (opo, 0, sizeof(ofp_packet_out));
+  opo->header.version = OFP_VERSION;
+  opo->header.type = OFPT_PACKET_OUT;
+  opo->header.length = htons (sizeof(ofp_packet_out) + actions_len + data_len);
+  opo->buffer_id = htonl (buffer_id);
+  opo->in_port = htons (in_port);
+  opo->actions_len = htons (actions_len);
+  memcpy (opo->actions, acts, actions_len);
+  if (data_len > 0)
+    {
+      memcpy ((uint8_t*)opo->actions + actions_len, data, data_len);
+    }
+  return opo;
+}
+
 uint8_t
 Controller::GetPacketType (ofpbuf* buffer)
 {
@@ -787,11 +1227,16 @@ DropController::ReceiveFromSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* b
       key.wildcards = 0;
       flow_extract (buffer, port != -1 ? port : OFPP_NONE, &key.flow);
 
-      ofp_flow_mod* ofm = BuildFlow (key, opi->buffer_id, OFPFC_ADD, 0, 0, OFP_FLOW_PERMANENT, OFP_FLOW_PERMANENT);
-      SendToSwitch (swtch, ofm, ofm->header.length);
+      FlowSpec spec;
+      spec.SetMatch (key.flow, 0);
+      spec.buffer_id = ntohl (opi->buffer_id);
+      SendFlow (swtch, spec);
     }
 }
 
+const uint16_t LearningController::NO_ROUTE;
+const uint32_t LearningController::NO_EQUAL_COST;
+
 TypeId LearningController::GetTypeId (void)
 {
   static TypeId tid = TypeId ("ns3::ofi::LearningController")
@@ -803,387 +1248,955 @@ TypeId LearningController::GetTypeId (void)
                    TimeValue (Seconds (0)),
                    MakeTimeAccessor (&LearningController::m_expirationTime),
                    MakeTimeChecker ())
+    .AddAttribute ("Proactive",
+                   "Install a flow for every host in every switch as soon as the topology is known, "
+                   "so the first packet of a host pair needs no controller round trip. "
+                   "A host the planes route differently only gets a flow for ARP; its IP flows are installed as they miss.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&LearningController::m_proactive),
+                   MakeBooleanChecker ())
+    .AddAttribute ("AggregateFlows",
+                   "Install flows that match only the destination address whenever the route doesn't depend on anything else, "
+                   "instead of one exact-match flow per packet header.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&LearningController::m_aggregateFlows),
+                   MakeBooleanChecker ())
+    .AddAttribute ("ProxyArp",
+                   "Answer ARP requests from the controller when the target address has been seen, "
+                   "instead of flooding them through the network.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&LearningController::m_proxyArp),
+                   MakeBooleanChecker ())
   ;
   return tid;
 }
 
 void
-LearningController::setaddress(Mac48Address switchid,Mac48Address newswitchid,LearnStateSwitchMap_t *switchmap)
-{
-	// NS_LOG_INFO ("reconfiguring "<<switchid<<" using "<<newswitchid<<"\n\n");
-	LearnStateSwitchMap_t::iterator st1 =switchmap->find(switchid);
-	LearnStateSwitchMap_t::iterator st2 = switchmap->find(newswitchid);
-	int32_t flag=0;
-	if(st1==switchmap->end()||st2==switchmap->end())
-	{
-		return;
-	}
-	else
-	{ // Dijkstras Algorithm
-		LearnState_t::iterator st = (st1->second).find(newswitchid);
-		uint32_t port_no=(st->second).port;
-
-		for(LearnState_t::iterator it = (st2->second).begin(); it != (st2->second).end(); it++ )
-			{
-				if((it->second).dist!=-1)
-				{
-					int32_t dist_before=(it->second).dist;
-					LearnState_t::iterator st4=(st1->second).find(it->first);
-					if(st4==(st1->second).end())
-					{
-						LearnedState ls;
-						ls.port = port_no;
-						ls.dist=dist_before+1;
-						(st1->second).insert(std::make_pair(it->first,ls));
-						flag=1;
-					}
-					else
-					{
-						if((st4->second).dist>(dist_before+1))
-						{
-							(st4->second).port=port_no;
-							(st4->second).dist=dist_before+1;
-							flag=1;
-						}
-					}
-				}
-			}
-		if(flag==1)
-		{
-			for(LearnState_t::iterator it=(st1->second).begin();it!=(st1->second).end();++it)
-			{
-				//NS_LOG_INFO (it->first<<" =="<<newswitchid);
-				if((it->second).dist==-1&&(it->first)!=newswitchid)
-				{
-				//	NS_LOG_INFO ("entereds");
-					setaddress(it->first,switchid,switchmap);
-				}
-			}
-		}
-	}
-}
-void
-LearningController::create_path_helper(Mac48Address switchid,std::map<uint32_t,Mac48Address>switchlist,std::map<uint32_t,Mac48Address>nodelist,LearnStateSwitchMap_t *switchmap)
+LearningController::create_path(Mac48Address switchid,const std::map<uint32_t,Mac48Address>& switchlist,const std::map<uint32_t,Mac48Address>& nodelist,uint32_t high_traffic_flag)
 {
-	std::map<uint32_t,Mac48Address>::iterator it;
-		LearnState_t templs;
-		for(it = nodelist.begin(); it != nodelist.end(); it++ )
-		{
-			LearnedState ls;
-			ls.port = it->first;
-			ls.dist=1;
-			templs.insert(std::make_pair (it->second,ls));
-		}
-		for(it = switchlist.begin(); it != switchlist.end(); it++ )
-		{
-			LearnedState ls;
-			ls.port = it->first;
-			ls.dist=-1;
-			templs.insert(std::make_pair (it->second,ls));
-		}
-		switchmap->insert(std::make_pair (switchid,templs));
+  TopologySwitch& sw = m_topology[switchid];
+  sw.switches = switchlist;
+  sw.hosts = nodelist;
+  sw.highTraffic = high_traffic_flag == 1;
+
+  // Index everything now, so the routes are computed over fixed-size tables.
+  GetSwitchIndex (switchid);
+  for (std::map<uint32_t,Mac48Address>::const_iterator it = switchlist.begin (); it != switchlist.end (); it++)
+    {
+      GetAddressIndex (it->second);
+    }
+  for (std::map<uint32_t,Mac48Address>::const_iterator it = nodelist.begin (); it != nodelist.end (); it++)
+    {
+      GetAddressIndex (it->second);
+    }
 
+  m_routesStale = true;
 }
 
+uint32_t
+LearningController::GetSwitchIndex (Mac48Address switchid)
+{
+  std::pair<AddressIndex_t::iterator, bool> ins = m_switchIndex.insert (std::make_pair (switchid, m_switchIndex.size ()));
+  if (ins.second)
+    {
+      for (int plane = FAST; plane <= SLOW; plane++)
+        {
+          m_nextHop[plane].resize (m_switchIndex.size () * m_addressStride, NO_ROUTE);
+        }
+    }
+  return ins.first->second;
+}
 
-void
-LearningController::create_path(Mac48Address switchid,std::map<uint32_t,Mac48Address>switchlist,std::map<uint32_t,Mac48Address>nodelist,uint32_t high_traffic_flag)
-{
-	if(high_traffic_flag==1)
-	{
-		m_slowSwitchList.insert(switchid);
-		create_path_helper(switchid,switchlist,nodelist,&m_LearnStateSwitchMap);
-		std::set<uint32_t> tportlist;
-		for(std::map<uint32_t,Mac48Address>::iterator  it = switchlist.begin(); it != switchlist.end(); it++ )
-		{
-			tportlist.insert(it->first);
-			setaddress(it->second,switchid,&m_LearnStateSwitchMap);//getting data from neighbors
-			setaddress(switchid,it->second,&m_LearnStateSwitchMap);//setting neighbor  with current data
-		}
-		for(std::map<uint32_t,Mac48Address>::iterator  it = nodelist.begin(); it != nodelist.end(); it++ )
-				{
-					tportlist.insert(it->first);
-				}
-
-		m_allPortList.insert(std::make_pair (switchid,tportlist));
-	}
-	else
-	{
-		std::set<uint32_t> tportlist1,tportlist2;
-		for(std::map<uint32_t,Mac48Address>::iterator  it = nodelist.begin(); it != nodelist.end(); it++ )
-						{
-							tportlist1.insert(it->first);
-							tportlist2.insert(it->first);
-						}
-		create_path_helper(switchid,switchlist,nodelist,&m_LearnStateSwitchMap);
-		for(std::map<uint32_t,Mac48Address>::iterator  it = switchlist.begin(); it != switchlist.end(); it++ )
-				{
-					tportlist1.insert(it->first);
-					setaddress(it->second,switchid,&m_LearnStateSwitchMap);//getting data from neighbors
-					setaddress(switchid,it->second,&m_LearnStateSwitchMap);//setting neighbor  with current data
-				}
-		create_path_helper(switchid,switchlist,nodelist,&m_LearnStateSwitchMapSlow);
-		for(std::map<uint32_t,Mac48Address>::iterator it = switchlist.begin(); it != switchlist.end(); it++ )
-				{
-					if(m_slowSwitchList.find(it->second)==m_slowSwitchList.end())
-					{
-						tportlist2.insert(it->first);
-						setaddress(it->second,switchid,&m_LearnStateSwitchMapSlow);//getting data from neighbors
-						setaddress(switchid,it->second,&m_LearnStateSwitchMapSlow);//setting neighbor  with current data
-					}
-				}
-		m_allPortList.insert(std::make_pair (switchid,tportlist1));
-		m_slowPortList.insert(std::make_pair (switchid,tportlist1));
-	}
+uint32_t
+LearningController::GetAddressIndex (Mac48Address address)
+{
+  std::pair<AddressIndex_t::iterator, bool> ins = m_addressIndex.insert (std::make_pair (address, m_addressIndex.size ()));
+  if (ins.second && m_addressIndex.size () > m_addressStride)
+    {
+      // Out of columns; double the row length and move the rows over.
+      uint32_t stride = std::max<uint32_t> (16, 2 * m_addressStride);
+      for (int plane = FAST; plane <= SLOW; plane++)
+        {
+          std::vector<uint16_t> table (m_switchIndex.size () * stride, NO_ROUTE);
+          for (uint32_t sw = 0; sw < m_switchIndex.size (); sw++)
+            {
+              std::copy (m_nextHop[plane].begin () + sw * m_addressStride,
+                         m_nextHop[plane].begin () + (sw + 1) * m_addressStride,
+                         table.begin () + sw * stride);
+            }
+          m_nextHop[plane].swap (table);
+        }
+      m_addressStride = stride;
+    }
+  return ins.first->second;
 }
+
 void
-LearningController::ReceiveFromSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer)
+LearningController::FinalizeTopology (void)
 {
+  UpdateRoutes ();
+}
 
-	LearnStateSwitchMap_t *m_learnStateSwitchMapptr=&m_LearnStateSwitchMap;
-  if (m_switches.find (swtch) == m_switches.end ())
+void
+LearningController::UpdateRoutes (void)
+{
+  if (!m_routesStale)
     {
-      NS_LOG_ERROR ("Can't receive from this switch, not registered to the Controller.");
       return;
     }
-  Mac48Address switchid=Mac48Address::ConvertFrom(swtch->GetAddress());
-  NS_LOG_INFO ("current Switch  id "<<switchid);
-  // We have received any packet at this point, so we pull the header to figure out what type of packet we're handling.
-  uint8_t type = GetPacketType (buffer);
-  if (type == OFPT_PACKET_IN) // The switch didn't understand the packet it received, so it forwarded it to the controller.
+
+  ComputeRoutes (FAST);
+  ComputeRoutes (SLOW);
+  ComputeFloodTree ();
+  m_routesStale = false;
+  if (m_proactive)
     {
-      ofp_packet_in * opi = (ofp_packet_in*)ofpbuf_try_pull (buffer, offsetof (ofp_packet_in, data));
-      int port = ntohs (opi->in_port);
-      
-      // Create matching key.
-      sw_flow_key key;
-      key.wildcards = 0;
-      flow_extract (buffer, port != -1 ? port : OFPP_NONE, &key.flow);
-       
-      uint16_t out_port = OFPP_FLOOD;
-      uint16_t in_port = ntohs (key.flow.in_port);
-      int ftpflag=0;
-     if(buffer->l4!=NULL)
-      {
-    	 tcp_header* tcp_h = (tcp_header*)buffer->l4;
-    	 if(tcp_h->tcp_src<600)
-    	 {
-    		 m_learnStateSwitchMapptr=&m_LearnStateSwitchMapSlow;
-    		 ftpflag=1;
-    	 }
-      }
+      InstallRoutes ();
+    }
+}
 
-     // If the destination address is learned to a specific port, find it.
-      Mac48Address dst_addr;
-      dst_addr.CopyFrom (key.flow.dl_dst);
-      if (!dst_addr.IsBroadcast ())
-        {    
-                LearnStateSwitchMap_t::iterator st1 = m_learnStateSwitchMapptr->find(switchid);
-                if(st1!=m_learnStateSwitchMapptr->end())
+void
+LearningController::InstallRoutes (void)
+{
+  for (Switches_t::const_iterator it = m_switches.begin (); it != m_switches.end (); it++)
+    {
+      Ptr<OpenFlowSwitchNetDevice> swtch = *it;
+      AddressIndex_t::const_iterator sw = m_switchIndex.find (Mac48Address::ConvertFrom (swtch->GetAddress ()));
+      if (sw == m_switchIndex.end ())
+        {
+          continue;
+        }
+
+      for (Topology_t::const_iterator t = m_topology.begin (); t != m_topology.end (); t++)
+        {
+          for (std::map<uint32_t,Mac48Address>::const_iterator h = t->second.hosts.begin (); h != t->second.hosts.end (); h++)
+            {
+              uint32_t d = m_addressIndex[h->second];
+              uint16_t hop = NextHop (FAST, sw->second, d);
+              if (hop == NO_ROUTE || EqualCost (FAST, sw->second, d) != NO_EQUAL_COST
+                  || EqualCost (SLOW, sw->second, d) != NO_EQUAL_COST)
                 {
-                    LearnState_t::iterator st = (st1->second).find(dst_addr);
-                    if (st != (st1->second).end ())
-                    {
-                      out_port = st->second.port;
-                    }
-                    else
-                    {
-                      NS_LOG_INFO ("Setting to flood; don't know yet what port " << dst_addr << " is connected to");
-                    }
+                  continue;
                 }
-                else
-                    {
-                      NS_LOG_INFO ("Setting to flood; switch not found in controller is connected to");
-                    }
-          }
-        else
-        {
-                NS_LOG_INFO ("Setting to flood; this packet is a broadcast");
-                Mac48Address src_addr;
-                src_addr.CopyFrom (key.flow.dl_src);
-                LastbroadcastportMap_t ::iterator st1 = m_lastbroadcastMapport.find(switchid);
-                if(st1!= m_lastbroadcastMapport.end())
-                 {
-                    if(st1->second==in_port)
-                    {
-                      //to drop
-                      ofp_flow_mod* ofm = BuildFlow (key, opi->buffer_id, OFPFC_ADD, 0, 0, OFP_FLOW_PERMANENT, OFP_FLOW_PERMANENT);
-                      SendToSwitch (swtch, ofm, ofm->header.length);
-                      return;
-                    }
-                    st1->second=in_port;
-                  }
-                  else
-                  {
-                    m_lastbroadcastMapport.insert(std::make_pair (switchid,in_port));
-                  }
+
+              ofp_action_output x[1];
+              x[0].type = htons (OFPAT_OUTPUT);
+              x[0].len = htons (sizeof(ofp_action_output));
+              x[0].port = hop;
+              x[0].max_len = 0;
+
+              // Everything but the destination address is wildcarded, if both planes agree on the route.
+              flow match;
+              memset (&match, 0, sizeof match);
+              h->second.CopyTo (match.dl_dst);
+              FlowSpec spec;
+              if (hop == NextHop (SLOW, sw->second, d))
+                {
+                  spec.SetMatch (match, OFPFW_ALL & ~OFPFW_DL_DST);
                 }
-        NS_LOG_INFO ("output port"<<out_port);
-      // Create output-to-port action
-      ofp_action_output x[1];
-      x[0].type = htons (OFPAT_OUTPUT);
-      x[0].len = htons (sizeof(ofp_action_output));
-      x[0].port = out_port;
+              else
+                {
+                  // The plane is picked by a range of transport source ports no flow can match;
+                  // only ARP is sure to take the fast plane. IP packets miss and get exact flows.
+                  match.dl_type = htons (ArpL3Protocol::PROT_NUMBER);
+                  spec.SetMatch (match, OFPFW_ALL & ~(OFPFW_DL_DST | OFPFW_DL_TYPE));
+                }
+              spec.actions = (ofp_action_header*)x;
+              spec.actions_len = sizeof(x);
+              SendFlow (swtch, spec);
+            }
+        }
+      InstallFloodFlow (swtch, -1);
+    }
+}
 
-      // Create a new flow that outputs matched packets to a learned port, OFPP_FLOOD if there's no learned port.
-      
-      
-       if (!dst_addr.IsBroadcast ())
+void
+LearningController::ComputeFloodTree (void)
+{
+  uint32_t n = m_switchIndex.size ();
+  std::vector<Topology_t::const_iterator> switches (n, m_topology.end ());
+  for (Topology_t::const_iterator it = m_topology.begin (); it != m_topology.end (); it++)
+    {
+      switches[m_switchIndex[it->first]] = it;
+    }
+
+  m_floodTree.assign (n, std::vector<uint16_t> ());
+  std::vector<bool> reached (n, false);
+  std::vector<uint32_t> queue;
+  queue.reserve (n);
+  for (uint32_t root = 0; root < n; root++)
+    {
+      if (switches[root] == m_topology.end () || reached[root])
         {
-          ofp_flow_mod* ofm = BuildFlow (key, opi->buffer_id, OFPFC_ADD, x, sizeof(x), OFP_FLOW_PERMANENT, m_expirationTime.IsZero () ? OFP_FLOW_PERMANENT : m_expirationTime.GetSeconds ());
-         SendToSwitch (swtch, ofm, ofm->header.length);
+          continue;
         }
-        else
-        {
-        	 PortList_t::iterator st1x;
-        	 if( ftpflag==1)
-        	 {
-        		 st1x = m_slowPortList.find(switchid);
-        	 }
-        	 else
-        	 {
-        		 st1x = m_allPortList.find(switchid);
-        	 }
-        for(std::set<uint32_t> ::iterator itrx=(st1x->second).begin();itrx!=(st1x->second).end();itrx++)
+
+      // Every link the search first reaches a switch over is a tree link; the others would close loops.
+      reached[root] = true;
+      queue.clear ();
+      queue.push_back (root);
+      for (size_t head = 0; head < queue.size (); head++)
         {
-        	if(*itrx!=in_port)
-        	{
-        		x[0].port=*itrx;
-        	}
+          uint32_t v = queue[head];
+          const std::map<uint32_t,Mac48Address>& links = switches[v]->second.switches;
+          for (std::map<uint32_t,Mac48Address>::const_iterator it = links.begin (); it != links.end (); it++)
+            {
+              AddressIndex_t::const_iterator u = m_switchIndex.find (it->second);
+              if (u == m_switchIndex.end () || switches[u->second] == m_topology.end () || reached[u->second]
+                  || !IsLinkUp (switches[v], it->first))
+                {
+                  continue;
+                }
+              reached[u->second] = true;
+              queue.push_back (u->second);
+              m_floodTree[v].push_back (it->first);
+
+              // The neighbour floods back over its end of the same link.
+              uint16_t back = GetPeerPort (switches[v], it->first);
+              if (back != NO_ROUTE)
+                {
+                  m_floodTree[u->second].push_back (back);
+                }
+            }
         }
+    }
 
-        ofp_flow_mod* ofm = BuildFlow (key, opi->buffer_id, OFPFC_ADD, x, sizeof(x), 0, 0);
-        SendToSwitch (swtch, ofm, ofm->header.length);
-        ofm = BuildFlow (key, opi->buffer_id, OFPFC_MODIFY, 0,0, 0, 0);
-        SendToSwitch (swtch, ofm, ofm->header.length);
+  for (uint32_t v = 0; v < n; v++)
+    {
+      if (switches[v] == m_topology.end ())
+        {
+          continue;
         }
-      
-      // We can learn a specific port for the source address for future use.
-      Mac48Address src_addr;
-      src_addr.CopyFrom (key.flow.dl_src);
-      LearnStateSwitchMap_t::iterator st1 = m_learnStateSwitchMapptr->find(switchid);
-      if(st1==m_learnStateSwitchMapptr->end())
-      {
-         NS_LOG_INFO ("switch not found adding to learner");
-        LearnedState ls;
-        ls.port = in_port;
-        LearnState_t templs;
-        templs.insert(std::make_pair (src_addr,ls));
-        m_learnStateSwitchMapptr->insert(std::make_pair (switchid,templs));
-        NS_LOG_INFO ("Learned that for switch "<<swtch <<"source address" << src_addr << " can be found over port " << in_port);
-         // Learn src_addr goes to a certain port.
-          ofp_action_output x2[1];
-          x2[0].type = htons (OFPAT_OUTPUT);
-          x2[0].len = htons (sizeof(ofp_action_output));
-          x2[0].port = in_port;
+      const std::map<uint32_t,Mac48Address>& hosts = switches[v]->second.hosts;
+      for (std::map<uint32_t,Mac48Address>::const_iterator it = hosts.begin (); it != hosts.end (); it++)
+        {
+          if (m_downPorts.find (std::make_pair (v, (uint16_t)it->first)) == m_downPorts.end ())
+            {
+              m_floodTree[v].push_back (it->first);
+            }
+        }
+    }
+}
 
-          // Switch MAC Addresses and ports to the flow we're modifying
-          src_addr.CopyTo (key.flow.dl_dst);
-          dst_addr.CopyTo (key.flow.dl_src);
-          key.flow.in_port = out_port;
-          ofp_flow_mod* ofm2 = BuildFlow (key, -1, OFPFC_MODIFY, x2, sizeof(x2), OFP_FLOW_PERMANENT, m_expirationTime.IsZero () ? OFP_FLOW_PERMANENT : m_expirationTime.GetSeconds ());
-          SendToSwitch (swtch, ofm2, ofm2->header.length);
-      }
-      else 
-      {
-         NS_LOG_INFO ("switch found in learner");
-        LearnState_t::iterator st = (st1->second).find(src_addr);
-        LearnState_t::iterator st2;
-        
-
-      //   NS_LOG_INFO ("searching for mac in switch");
-      //   for(st2 = (st1->second).begin(); st2 != (st1->second).end(); st2++ )
-		    // {
-      //   	NS_LOG_INFO ("content of map 1"<<st2->first);
-		    // }
-
-        if(st==(st1->second).end())
-        { 
-          LearnedState ls;
-          ls.port = in_port;
-         (st1->second).insert(std::make_pair (src_addr,ls));
-          NS_LOG_INFO ("Learned that for switch "<<swtch <<"source address" << src_addr << " can be found over port " << in_port);
-          // Learn src_addr goes to a certain port.
-          ofp_action_output x2[1];
-          x2[0].type = htons (OFPAT_OUTPUT);
-          x2[0].len = htons (sizeof(ofp_action_output));
-          x2[0].port = in_port;
+uint16_t
+LearningController::GetPeerPort (Topology_t::const_iterator sw, uint16_t port) const
+{
+  std::map<uint32_t,Mac48Address>::const_iterator link = sw->second.switches.find (port);
+  if (link == sw->second.switches.end ())
+    {
+      return NO_ROUTE;
+    }
+  Topology_t::const_iterator peer = m_topology.find (link->second);
+  if (peer == m_topology.end ())
+    {
+      return NO_ROUTE;
+    }
+  const std::map<uint32_t,Mac48Address>& back = peer->second.switches;
 
-          // Switch MAC Addresses and ports to the flow we're modifying
-          src_addr.CopyTo (key.flow.dl_dst);
-          dst_addr.CopyTo (key.flow.dl_src);
-          key.flow.in_port = out_port;
-          ofp_flow_mod* ofm2 = BuildFlow (key, -1, OFPFC_MODIFY, x2, sizeof(x2), OFP_FLOW_PERMANENT, m_expirationTime.IsZero () ? OFP_FLOW_PERMANENT : m_expirationTime.GetSeconds ());
-          SendToSwitch (swtch, ofm2, ofm2->header.length);
+  // Switches connected to the controller know which of their ports share the channel of the link.
+  Ptr<OpenFlowSwitchNetDevice> near, far;
+  for (Switches_t::const_iterator it = m_switches.begin (); it != m_switches.end (); it++)
+    {
+      Mac48Address address = Mac48Address::ConvertFrom ((*it)->GetAddress ());
+      if (address == sw->first)
+        {
+          near = *it;
+        }
+      else if (address == peer->first)
+        {
+          far = *it;
+        }
+    }
+  if (near != 0 && far != 0 && port < near->GetNSwitchPorts ())
+    {
+      Ptr<Channel> channel = near->GetSwitchPort (port).netdev->GetChannel ();
+      for (uint32_t q = 0; channel != 0 && q < far->GetNSwitchPorts (); q++)
+        {
+          std::map<uint32_t,Mac48Address>::const_iterator b = back.find (q);
+          if (b != back.end () && b->second == sw->first && far->GetSwitchPort (q).netdev->GetChannel () == channel)
+            {
+              return q;
+            }
+        }
+    }
+
+  // Otherwise parallel links are paired in port order.
+  uint32_t rank = 0;
+  for (std::map<uint32_t,Mac48Address>::const_iterator it = sw->second.switches.begin (); it != link; it++)
+    {
+      if (it->second == peer->first)
+        {
+          rank++;
+        }
+    }
+  for (std::map<uint32_t,Mac48Address>::const_iterator it = back.begin (); it != back.end (); it++)
+    {
+      if (it->second == sw->first && rank-- == 0)
+        {
+          return it->first;
         }
-      }
     }
+  return NO_ROUTE;
 }
+
+bool
+LearningController::IsLinkUp (Topology_t::const_iterator sw, uint16_t port) const
+{
+  if (m_downPorts.empty ())
+    {
+      return true;
+    }
+  // Either end may be the one that reported the link down.
+  AddressIndex_t::const_iterator u = m_switchIndex.find (sw->first);
+  if (u != m_switchIndex.end () && m_downPorts.find (std::make_pair (u->second, port)) != m_downPorts.end ())
+    {
+      return false;
+    }
+  std::map<uint32_t,Mac48Address>::const_iterator link = sw->second.switches.find (port);
+  AddressIndex_t::const_iterator v = link != sw->second.switches.end () ? m_switchIndex.find (link->second) : m_switchIndex.end ();
+  uint16_t back = GetPeerPort (sw, port);
+  return v == m_switchIndex.end () || back == NO_ROUTE || m_downPorts.find (std::make_pair (v->second, back)) == m_downPorts.end ();
+}
+
 void
-ExecuteActions (Ptr<OpenFlowSwitchNetDevice> swtch, uint64_t packet_uid, ofpbuf* buffer, sw_flow_key *key, const ofp_action_header *actions, size_t actions_len, int ignore_no_fwd)
+LearningController::InstallFloodFlow (Ptr<OpenFlowSwitchNetDevice> swtch, uint32_t buffer_id)
 {
-  NS_LOG_FUNCTION_NOARGS ();
-  /* Every output action needs a separate clone of 'buffer', but the common
-   * case is just a single output action, so that doing a clone and then
-   * freeing the original buffer is wasteful.  So the following code is
-   * slightly obscure just to avoid that. */
-  int prev_port;
-  size_t max_len = 0;     // Initialize to make compiler happy
-  uint16_t in_port = key->flow.in_port; // ntohs(key->flow.in_port);
-  uint8_t *p = (uint8_t *)actions;
+  // The switch never sends a packet back out of the port it came in on, so one flow serves every port.
+  std::vector<ofp_action_output> x = GetFloodActions (swtch);
+
+  flow match;
+  memset (&match, 0, sizeof match);
+  Mac48Address::GetBroadcast ().CopyTo (match.dl_dst);
+  FlowSpec spec;
+  spec.SetMatch (match, OFPFW_ALL & ~OFPFW_DL_DST);
+  spec.buffer_id = buffer_id;
+  spec.actions = (ofp_action_header*)&x[0];
+  spec.actions_len = x.size () * sizeof(ofp_action_output);
+  SendFlow (swtch, spec);
+
+  if (m_proxyArp)
+    {
+      // ARP requests must keep reaching the controller; send them there ahead of the flood flow.
+      ofp_action_output y[1];
+      y[0].type = htons (OFPAT_OUTPUT);
+      y[0].len = htons (sizeof(ofp_action_output));
+      y[0].port = OFPP_CONTROLLER;
+      y[0].max_len = 0;
+
+      match.dl_type = htons (ArpL3Protocol::PROT_NUMBER);
+      spec.SetMatch (match, OFPFW_ALL & ~(OFPFW_DL_DST | OFPFW_DL_TYPE));
+      spec.priority = OFP_DEFAULT_PRIORITY + 1;
+      spec.buffer_id = -1;
+      spec.actions = (ofp_action_header*)y;
+      spec.actions_len = sizeof(y);
+      SendFlow (swtch, spec);
+    }
+}
 
-  prev_port = -1;
+std::vector<ofp_action_output>
+LearningController::GetFloodActions (Ptr<OpenFlowSwitchNetDevice> swtch)
+{
+  std::vector<uint16_t> ports;
+  AddressIndex_t::const_iterator sw = m_switchIndex.find (Mac48Address::ConvertFrom (swtch->GetAddress ()));
+  if (sw != m_switchIndex.end () && sw->second < m_floodTree.size ())
+    {
+      ports = m_floodTree[sw->second];
+    }
+  if (ports.empty ())
+    {
+      ports.push_back (OFPP_FLOOD);
+    }
 
-  if (actions_len == 0)
+  std::vector<ofp_action_output> x (ports.size ());
+  for (size_t i = 0; i < ports.size (); i++)
     {
-      NS_LOG_INFO ("No actions set to this flow. Dropping packet.");
-      return;
+      x[i].type = htons (OFPAT_OUTPUT);
+      x[i].len = htons (sizeof(ofp_action_output));
+      x[i].port = ports[i];
+      x[i].max_len = 0;
+    }
+  return x;
+}
+
+bool
+LearningController::HandleArp (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer, uint32_t buffer_id, uint16_t in_port)
+{
+  Ptr<Packet> packet = Create<Packet> ((const uint8_t*)buffer->data, buffer->size);
+  EthernetHeader eth (false);
+  ArpHeader arp;
+  packet->RemoveHeader (eth);
+  packet->PeekHeader (arp);
+
+  Mac48Address requester = Mac48Address::ConvertFrom (arp.GetSourceHardwareAddress ());
+  Ipv4Address requesterIp = arp.GetSourceIpv4Address ();
+  Ipv4Address targetIp = arp.GetDestinationIpv4Address ();
+  m_arpTable[requesterIp.Get ()] = requester;
+  if (!arp.IsRequest ())
+    {
+      return false;
     }
 
-  /* The action list was already validated, so we can be a bit looser
-   * in our sanity-checking. */
-  while (actions_len > 0)
+  std::unordered_map<uint32_t, Mac48Address>::const_iterator target = m_arpTable.find (targetIp.Get ());
+  if (target == m_arpTable.end ())
     {
-      ofp_action_header *ah = (ofp_action_header *)p;
-      size_t len = htons (ah->len);
+      NS_LOG_INFO ("Flooding ARP request for unknown address " << targetIp);
+      std::vector<ofp_action_output> x = GetFloodActions (swtch);
+      if (buffer_id == std::numeric_limits<uint32_t>::max ())
+        {
+          SendPacketOut (swtch, packet, eth.GetLengthType (), eth.GetSource (), eth.GetDestination (), in_port,
+                         &x[0], x.size () * sizeof(ofp_action_output));
+        }
+      else
+        {
+          SendPacketOut (swtch, buffer_id, in_port, &x[0], x.size () * sizeof(ofp_action_output));
+        }
+      return true;
+    }
+
+  NS_LOG_INFO ("Answering ARP request for " << targetIp << " with " << target->second);
+  ArpHeader reply;
+  reply.SetReply (target->second, targetIp, requester, requesterIp);
+  Ptr<Packet> frame = Create<Packet> ();
+  frame->AddHeader (reply);
+
+  // The reply goes back out of the port the request came in on; the request itself is dropped.
+  ofp_action_output x[1];
+  x[0].type = htons (OFPAT_OUTPUT);
+  x[0].len = htons (sizeof(ofp_action_output));
+  x[0].port = OFPP_IN_PORT;
+  x[0].max_len = 0;
+  SendPacketOut (swtch, frame, ArpL3Protocol::PROT_NUMBER, target->second, requester, in_port, x, sizeof(x));
+  if (buffer_id != std::numeric_limits<uint32_t>::max ())
+    {
+      SendPacketOut (swtch, buffer_id, in_port, x, 0);
+    }
+  return true;
+}
 
-      if (prev_port != -1)
+void
+LearningController::ComputeRoutes (Plane plane)
+{
+  std::fill (m_nextHop[plane].begin (), m_nextHop[plane].end (), NO_ROUTE);
+  m_equalCost[plane].clear ();
+  m_equalCostPorts[plane].clear ();
+
+  // The switches of the plane, by index.
+  uint32_t n = m_switchIndex.size ();
+  std::vector<Topology_t::const_iterator> switches (n, m_topology.end ());
+  for (Topology_t::const_iterator it = m_topology.begin (); it != m_topology.end (); it++)
+    {
+      if (!(plane == SLOW && it->second.highTraffic))
         {
-          swtch->DoOutput (packet_uid, in_port, max_len, prev_port, ignore_no_fwd);
-          prev_port = -1;
+          switches[m_switchIndex[it->first]] = it;
         }
+    }
 
-      if (ah->type == htons (OFPAT_OUTPUT))
+  // Links into each switch, as (neighbour, port of the neighbour); a search from
+  // the switch of a host follows them backwards.
+  std::vector<std::vector<std::pair<uint32_t, uint16_t> > > links (n);
+  for (uint32_t u = 0; u < n; u++)
+    {
+      if (switches[u] == m_topology.end ())
+        {
+          continue;
+        }
+      const TopologySwitch& s = switches[u]->second;
+      for (std::map<uint32_t,Mac48Address>::const_iterator it = s.switches.begin (); it != s.switches.end (); it++)
+        {
+          if (!IsLinkUp (switches[u], it->first))
+            {
+              continue;
+            }
+          NextHop (plane, u, m_addressIndex[it->second]) = it->first;
+          AddressIndex_t::const_iterator v = m_switchIndex.find (it->second);
+          if (v != m_switchIndex.end () && switches[v->second] != m_topology.end ())
+            {
+              links[v->second].push_back (std::make_pair (u, it->first));
+            }
+        }
+      for (std::map<uint32_t,Mac48Address>::const_iterator it = s.hosts.begin (); it != s.hosts.end (); it++)
         {
-          ofp_action_output *oa = (ofp_action_output *)p;
+          if (m_downPorts.find (std::make_pair (u, (uint16_t)it->first)) == m_downPorts.end ())
+            {
+              NextHop (plane, u, m_addressIndex[it->second]) = it->first;
+            }
+        }
+    }
 
-          // port is now 32-bits
-          prev_port = oa->port; // ntohl(oa->port);
-          // prev_port = ntohs(oa->port);
-          max_len = ntohs (oa->max_len);
+  // One search per switch with hosts; every host behind it shares the result.
+  std::vector<uint32_t> hosts;
+  std::vector<bool> reached (n);
+  std::vector<uint32_t> dist (n);
+  std::vector<uint32_t> queue;
+  queue.reserve (n);
+  std::vector<std::pair<uint32_t, uint16_t> > others; // Ports of the other shortest paths, by switch.
+  for (uint32_t t = 0; t < n; t++)
+    {
+      if (switches[t] == m_topology.end () || switches[t]->second.hosts.empty ())
+        {
+          continue;
         }
-      else
+      hosts.clear ();
+      for (std::map<uint32_t,Mac48Address>::const_iterator h = switches[t]->second.hosts.begin (); h != switches[t]->second.hosts.end (); h++)
         {
-          uint16_t type = ntohs (ah->type);
-          if (Action::IsValidType ((ofp_action_type)type)) // Execute a built-in OpenFlow action against 'buffer'.
+          if (NextHop (plane, t, m_addressIndex[h->second]) != NO_ROUTE) // Not behind a dead port.
             {
-              Action::Execute ((ofp_action_type)type, buffer, key, ah);
+              hosts.push_back (m_addressIndex[h->second]);
             }
-          else if (type == OFPAT_VENDOR)
+        }
+
+      std::fill (reached.begin (), reached.end (), false);
+      reached[t] = true;
+      dist[t] = 0;
+      queue.clear ();
+      queue.push_back (t);
+      others.clear ();
+      for (size_t head = 0; head < queue.size (); head++)
+        {
+          uint32_t v = queue[head];
+          for (size_t i = 0; i < links[v].size (); i++)
             {
-              ExecuteVendor (buffer, key, ah);
+              uint32_t u = links[v][i].first;
+              if (reached[u])
+                {
+                  if (dist[u] == dist[v] + 1)
+                    {
+                      others.push_back (std::make_pair (u, links[v][i].second));
+                    }
+                  continue;
+                }
+              reached[u] = true;
+              dist[u] = dist[v] + 1;
+              queue.push_back (u);
+
+              for (size_t h = 0; h < hosts.size (); h++)
+                {
+                  uint16_t& hop = NextHop (plane, u, hosts[h]);
+                  if (hop == NO_ROUTE) // Keep hosts attached to the switch itself.
+                    {
+                      hop = links[v][i].second;
+                    }
+                }
             }
         }
 
-      p += len;
-      actions_len -= len;
+      // A switch with several shortest paths gets one set, the next hop first,
+      // for all the hosts behind t; hosts attached to the switch itself keep their port.
+      std::sort (others.begin (), others.end ());
+      std::vector<uint16_t>& pool = m_equalCostPorts[plane];
+      for (size_t i = 0, j; i < others.size (); i = j)
+        {
+          uint32_t u = others[i].first;
+          for (j = i; j < others.size () && others[j].first == u; j++)
+            {
+            }
+          uint32_t set = NO_EQUAL_COST;
+          for (size_t h = 0; h < hosts.size (); h++)
+            {
+              uint16_t hop = NextHop (plane, u, hosts[h]);
+              if (switches[u]->second.hosts.find (hop) != switches[u]->second.hosts.end ())
+                {
+                  continue;
+                }
+              if (set == NO_EQUAL_COST)
+                {
+                  set = pool.size ();
+                  pool.push_back (j - i + 1);
+                  pool.push_back (hop);
+                  for (size_t k = i; k < j; k++)
+                    {
+                      pool.push_back (others[k].second);
+                    }
+                }
+              m_equalCost[plane][((uint64_t)u << 32) | hosts[h]] = set;
+            }
+        }
+    }
+}
+
+bool
+LearningController::ForwardAggregated (Ptr<OpenFlowSwitchNetDevice> swtch, Mac48Address dst, uint32_t buffer_id, uint16_t in_port)
+{
+  if (!m_aggregateFlows)
+    {
+      return false;
+    }
+  AddressIndex_t::const_iterator sw = m_switchIndex.find (Mac48Address::ConvertFrom (swtch->GetAddress ()));
+  AddressIndex_t::const_iterator d = m_addressIndex.find (dst);
+  if (sw == m_switchIndex.end () || d == m_addressIndex.end ())
+    {
+      return false;
+    }
+  // The plane is picked by the transport source port; a flow that ignores it has to be right for both.
+  // So does a destination with several paths, whose flows are spread over them.
+  uint16_t hop = NextHop (FAST, sw->second, d->second);
+  if (hop == NO_ROUTE || hop != NextHop (SLOW, sw->second, d->second)
+      || EqualCost (FAST, sw->second, d->second) != NO_EQUAL_COST || EqualCost (SLOW, sw->second, d->second) != NO_EQUAL_COST)
+    {
+      return false;
+    }
+
+  ofp_action_output x[1];
+  x[0].type = htons (OFPAT_OUTPUT);
+  x[0].len = htons (sizeof(ofp_action_output));
+  x[0].port = hop;
+  x[0].max_len = 0;
+
+  uint64_t cell = ((uint64_t)sw->second << 32) | d->second;
+  if (m_aggregated.insert (cell).second)
+    {
+      NS_LOG_INFO ("Installing flow for destination " << dst << " over port " << hop);
+      flow match;
+      memset (&match, 0, sizeof match);
+      dst.CopyTo (match.dl_dst);
+      FlowSpec spec;
+      spec.SetMatch (match, OFPFW_ALL & ~OFPFW_DL_DST);
+      spec.hard_timeout = m_expirationTime.IsZero () ? OFP_FLOW_PERMANENT : m_expirationTime.GetSeconds ();
+      spec.buffer_id = buffer_id;
+      spec.actions = (ofp_action_header*)x;
+      spec.actions_len = sizeof(x);
+      SendFlow (swtch, spec);
+    }
+  else
+    {
+      // Queued before the flow was in place, or the flow never made it to the
+      // switch; the mark is only a guess, so the next miss installs it again.
+      m_aggregated.erase (cell);
+      if (buffer_id != (uint32_t) -1)
+        {
+          SendPacketOut (swtch, buffer_id, in_port, x, sizeof(x));
+        }
+    }
+  return true;
+}
+
+void
+LearningController::ForgetAggregated (Ptr<OpenFlowSwitchNetDevice> swtch, Mac48Address dst)
+{
+  AddressIndex_t::const_iterator sw = m_switchIndex.find (Mac48Address::ConvertFrom (swtch->GetAddress ()));
+  if (sw == m_switchIndex.end ())
+    {
+      return;
+    }
+  uint64_t row = (uint64_t)sw->second << 32;
+  if (dst.IsBroadcast ())
+    {
+      m_aggregated.erase (m_aggregated.lower_bound (row), m_aggregated.lower_bound (row + ((uint64_t)1 << 32)));
+      return;
+    }
+  AddressIndex_t::const_iterator d = m_addressIndex.find (dst);
+  if (d != m_addressIndex.end ())
+    {
+      m_aggregated.erase (row | d->second);
+    }
+}
+
+bool
+LearningController::LookupRoute (Mac48Address switchid, Mac48Address dst, bool slow, uint32_t *port)
+{
+  UpdateRoutes ();
+  AddressIndex_t::const_iterator sw = m_switchIndex.find (switchid);
+  AddressIndex_t::const_iterator d = m_addressIndex.find (dst);
+  if (sw == m_switchIndex.end () || d == m_addressIndex.end ())
+    {
+      return false;
+    }
+  uint16_t hop = NextHop (slow ? SLOW : FAST, sw->second, d->second);
+  if (hop == NO_ROUTE)
+    {
+      return false;
+    }
+  *port = hop;
+  return true;
+}
+
+size_t
+LearningController::LookupEqualCostRoutes (Mac48Address switchid, Mac48Address dst, bool slow, std::vector<uint16_t> *ports)
+{
+  ports->clear ();
+  uint32_t port;
+  if (!LookupRoute (switchid, dst, slow, &port))
+    {
+      return 0;
+    }
+  Plane plane = slow ? SLOW : FAST;
+  uint32_t set = EqualCost (plane, m_switchIndex[switchid], m_addressIndex[dst]);
+  if (set != NO_EQUAL_COST)
+    {
+      const std::vector<uint16_t>& pool = m_equalCostPorts[plane];
+      ports->assign (pool.begin () + set + 1, pool.begin () + set + 1 + pool[set]);
+    }
+  else
+    {
+      ports->push_back (port);
+    }
+  return ports->size ();
+}
+
+uint16_t
+LearningController::SelectNextHop (Plane plane, uint32_t sw, uint32_t dst, const sw_flow_key& key)
+{
+  uint32_t set = EqualCost (plane, sw, dst);
+  if (set == NO_EQUAL_COST)
+    {
+      return NextHop (plane, sw, dst);
+    }
+
+  // FNV-1a over the 5-tuple. Seeding it with the switch keeps the switches
+  // along a path from all making the same choice.
+  uint8_t tuple[13];
+  memcpy (tuple, &key.flow.nw_src, 4);
+  memcpy (tuple + 4, &key.flow.nw_dst, 4);
+  memcpy (tuple + 8, &key.flow.tp_src, 2);
+  memcpy (tuple + 10, &key.flow.tp_dst, 2);
+  tuple[12] = key.flow.nw_proto;
+  uint32_t hash = 2166136261u ^ sw;
+  for (size_t i = 0; i < sizeof tuple; i++)
+    {
+      hash = (hash ^ tuple[i]) * 16777619u;
+    }
+  const uint16_t *hops = &m_equalCostPorts[plane][set];
+  return hops[1 + hash % hops[0]];
+}
+
+void
+LearningController::PortStatusChanged (Ptr<OpenFlowSwitchNetDevice> swtch, const ofp_port_status *ops)
+{
+  if (m_switches.find (swtch) == m_switches.end ())
+    {
+      NS_LOG_ERROR ("Can't receive from this switch, not registered to the Controller.");
+      return;
+    }
+  uint16_t port = ntohs (ops->desc.port_no);
+  bool down = ops->reason == OFPPR_DELETE || (ntohl (ops->desc.state) & OFPPS_LINK_DOWN);
+  Mac48Address switchid = Mac48Address::ConvertFrom (swtch->GetAddress ());
+  AddressIndex_t::const_iterator sw = m_switchIndex.find (switchid);
+  if (m_topology.find (switchid) != m_topology.end ())
+    {
+      // The routes and the flood tree come from the topology; recompute them without the link, or with it again.
+      std::pair<uint32_t, uint16_t> p (sw->second, port);
+      if (down ? !m_downPorts.insert (p).second : m_downPorts.erase (p) == 0)
+        {
+          return; // Already known.
+        }
+      m_routesStale = true;
+    }
+  else if (!down)
+    {
+      return; // Nothing learned is wrong when a link comes up.
+    }
+  else if (sw != m_switchIndex.end ())
+    {
+      // Forget the addresses learned over the port, in both planes.
+      for (int plane = FAST; plane <= SLOW; plane++)
+        {
+          for (uint32_t d = 0; d < m_addressIndex.size (); d++)
+            {
+              uint16_t& hop = NextHop ((Plane)plane, sw->second, d);
+              if (hop == port)
+                {
+                  hop = NO_ROUTE;
+                }
+            }
+        }
     }
+  NS_LOG_INFO ("Port " << port << " of switch " << switchid << " is " << (down ? "down" : "up"));
+
+  if (down)
+    {
+      // Delete every flow that outputs to the port; the next packets miss and are relearned.
+      ForgetAggregated (swtch, Mac48Address::GetBroadcast ());
+      flow match;
+      memset (&match, 0, sizeof match);
+      FlowSpec spec;
+      spec.command = OFPFC_DELETE;
+      spec.SetMatch (match, OFPFW_ALL);
+      spec.out_port = port;
+      SendFlow (swtch, spec);
+    }
+
+  if (m_routesStale)
+    {
+      UpdateRoutes ();
+      if (!m_proactive) // InstallRoutes has already replaced them.
+        {
+          for (Switches_t::const_iterator it = m_switches.begin (); it != m_switches.end (); it++)
+            {
+              InstallFloodFlow (*it, -1);
+            }
+        }
+    }
+}
 
-  if (prev_port != -1)
+void
+LearningController::ReceiveFromSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer)
+{
+
+  Plane plane = FAST;
+  if (m_switches.find (swtch) == m_switches.end ())
+    {
+      NS_LOG_ERROR ("Can't receive from this switch, not registered to the Controller.");
+      return;
+    }
+  Mac48Address switchid=Mac48Address::ConvertFrom(swtch->GetAddress());
+  NS_LOG_INFO ("current Switch  id "<<switchid);
+  UpdateRoutes ();
+  // We have received any packet at this point, so we pull the header to figure out what type of packet we're handling.
+  uint8_t type = GetPacketType (buffer);
+  if (type == OFPT_PORT_STATUS)
+    {
+      return; // Already handed to PortStatusChanged.
+    }
+  if (type == OFPT_FLOW_EXPIRED)
     {
-      swtch->DoOutput (packet_uid, in_port, max_len, prev_port, ignore_no_fwd);
+      const ofp_flow_expired *ofe = (ofp_flow_expired*)buffer->data;
+      if (ntohl (ofe->match.wildcards) == (OFPFW_ALL & ~OFPFW_DL_DST))
+        {
+          Mac48Address dst;
+          dst.CopyFrom (ofe->match.dl_dst);
+          ForgetAggregated (swtch, dst);
+        }
+      return;
+    }
+  if (type == OFPT_PACKET_IN) // The switch didn't understand the packet it received, so it forwarded it to the controller.
+    {
+      ofp_packet_in * opi = (ofp_packet_in*)ofpbuf_try_pull (buffer, offsetof (ofp_packet_in, data));
+      int port = ntohs (opi->in_port);
+      uint32_t buffer_id = ntohl (opi->buffer_id);
+      if (opi->reason == OFPR_ACTION)
+        {
+          // The switch dropped the packet once its flow's actions ran; only the frame came along.
+          buffer_id = -1;
+        }
+      
+      // Create matching key.
+      sw_flow_key key;
+      key.wildcards = 0;
+      flow_extract (buffer, port != -1 ? port : OFPP_NONE, &key.flow);
+       
+      uint16_t out_port = OFPP_FLOOD;
+      uint16_t in_port = ntohs (key.flow.in_port);
+     if(buffer->l4!=NULL)
+      {
+    	 tcp_header* tcp_h = (tcp_header*)buffer->l4;
+    	 if(tcp_h->tcp_src<600)
+    	 {
+    		 plane = SLOW;
+    	 }
+      }
+
+      bool handled = false;
+      if (m_proxyArp)
+        {
+          Mac48Address src_addr;
+          src_addr.CopyFrom (key.flow.dl_src);
+          if (ntohs (key.flow.dl_type) == Ipv4L3Protocol::PROT_NUMBER)
+            {
+              m_arpTable[ntohl (key.flow.nw_src)] = src_addr;
+            }
+          else if (ntohs (key.flow.dl_type) == ArpL3Protocol::PROT_NUMBER)
+            {
+              handled = HandleArp (swtch, buffer, buffer_id, in_port);
+            }
+        }
+
+     // If the destination address is learned to a specific port, find it.
+      Mac48Address dst_addr;
+      dst_addr.CopyFrom (key.flow.dl_dst);
+      if (!dst_addr.IsBroadcast ())
+        {    
+                AddressIndex_t::const_iterator sw = m_switchIndex.find (switchid);
+                AddressIndex_t::const_iterator d = m_addressIndex.find (dst_addr);
+                if (sw != m_switchIndex.end () && d != m_addressIndex.end () && NextHop (plane, sw->second, d->second) != NO_ROUTE)
+                    {
+                      out_port = SelectNextHop (plane, sw->second, d->second, key);
+                    }
+                else
+                    {
+                      NS_LOG_INFO ("Setting to flood; don't know yet what port " << dst_addr << " is connected to");
+                    }
+          }
+        else
+        {
+                NS_LOG_INFO ("Setting to flood; this packet is a broadcast");
+        }
+        NS_LOG_INFO ("output port"<<out_port);
+      // Create output-to-port action
+      ofp_action_output x[1];
+      x[0].type = htons (OFPAT_OUTPUT);
+      x[0].len = htons (sizeof(ofp_action_output));
+      x[0].port = out_port;
+      x[0].max_len = 0;
+
+      // Create a new flow that outputs matched packets to a learned port, OFPP_FLOOD if there's no learned port.
+      
+      
+       if (handled)
+        {
+          NS_LOG_INFO ("ARP request handled by the controller");
+        }
+       else if (!dst_addr.IsBroadcast ())
+        {
+          // A flow on the destination alone covers every later packet to it; otherwise match this exact packet.
+          if (out_port == OFPP_FLOOD || !ForwardAggregated (swtch, dst_addr, buffer_id, in_port))
+            {
+              FlowSpec spec;
+              spec.SetMatch (key.flow, 0);
+              spec.hard_timeout = m_expirationTime.IsZero () ? OFP_FLOW_PERMANENT : m_expirationTime.GetSeconds ();
+              spec.buffer_id = buffer_id;
+              spec.actions = (ofp_action_header*)x;
+              spec.actions_len = sizeof(x);
+              SendFlow (swtch, spec);
+            }
+        }
+        else
+        {
+          InstallFloodFlow (swtch, buffer_id);
+        }
+      
+      // We can learn a specific port for the source address for future use.
+      Mac48Address src_addr;
+      src_addr.CopyFrom (key.flow.dl_src);
+      uint32_t d = GetAddressIndex (src_addr); // May grow the tables; index them afterwards.
+      uint16_t& hop = NextHop (plane, GetSwitchIndex (switchid), d);
+      if (hop == NO_ROUTE)
+        {
+          hop = in_port;
+          NS_LOG_INFO ("Learned that for switch "<<swtch <<"source address" << src_addr << " can be found over port " << in_port);
+          // Learn src_addr goes to a certain port.
+          ofp_action_output x2[1];
+          x2[0].type = htons (OFPAT_OUTPUT);
+          x2[0].len = htons (sizeof(ofp_action_output));
+          x2[0].port = in_port;
+          x2[0].max_len = 0;
+
+          // Switch MAC Addresses and ports to the flow we're modifying
+          src_addr.CopyTo (key.flow.dl_dst);
+          dst_addr.CopyTo (key.flow.dl_src);
+          key.flow.in_port = out_port;
+          FlowSpec spec;
+          spec.command = OFPFC_MODIFY;
+          spec.SetMatch (key.flow, 0);
+          spec.hard_timeout = m_expirationTime.IsZero () ? OFP_FLOW_PERMANENT : m_expirationTime.GetSeconds ();
+          spec.actions = (ofp_action_header*)x2;
+          spec.actions_len = sizeof(x2);
+          SendFlow (swtch, spec);
+        }
     }
 }
+uint64_t
+FlowTimeNow (void)
+{
+  return (uint64_t)Simulator::Now ().GetSeconds ();
+}
+
+void
+ExecuteActions (Ptr<OpenFlowSwitchNetDevice> swtch, uint64_t packet_uid, ofpbuf* buffer, sw_flow_key *key, const ofp_action_header *actions, size_t actions_len, int ignore_no_fwd)
+{
+  ActionProgram program;
+  CompileActions (actions, actions_len, program);
+  ExecuteActions (swtch, packet_uid, buffer, key, program, ignore_no_fwd);
+}
 
 uint16_t
 ValidateActions (const sw_flow_key *key, const ofp_action_header *actions, size_t actions_len)
@@ -1242,50 +2255,9 @@ ValidateActions (const sw_flow_key *key, const ofp_action_header *actions, size_
 void
 ExecuteVPortActions (Ptr<OpenFlowSwitchNetDevice> swtch, uint64_t packet_uid, ofpbuf* buffer, sw_flow_key *key, const ofp_action_header *actions, size_t actions_len)
 {
-  /* Every output action needs a separate clone of 'buffer', but the common
-   * case is just a single output action, so that doing a clone and then
-   * freeing the original buffer is wasteful.  So the following code is
-   * slightly obscure just to avoid that. */
-  int prev_port;
-  size_t max_len = 0;     // Initialize to make compiler happy
-  uint16_t in_port = ntohs (key->flow.in_port);
-  uint8_t *p = (uint8_t *)actions;
-  uint16_t type;
-  ofp_action_output *oa;
-
-  prev_port = -1;
-  /* The action list was already validated, so we can be a bit looser
-   * in our sanity-checking. */
-  while (actions_len > 0)
-    {
-      ofp_action_header *ah = (ofp_action_header *)p;
-      size_t len = htons (ah->len);
-      if (prev_port != -1)
-        {
-          swtch->DoOutput (packet_uid, in_port, max_len, prev_port, false);
-          prev_port = -1;
-        }
-
-      if (ah->type == htons (OFPAT_OUTPUT))
-        {
-          oa = (ofp_action_output *)p;
-          prev_port = ntohl (oa->port);
-          max_len = ntohs (oa->max_len);
-        }
-      else
-        {
-          type = ah->type; // ntohs(ah->type);
-          VPortAction::Execute ((ofp_vport_action_type)type, buffer, key, ah);
-        }
-
-      p += len;
-      actions_len -= len;
-    }
-
-  if (prev_port != -1)
-    {
-      swtch->DoOutput (packet_uid, in_port, max_len, prev_port, false);
-    }
+  ActionProgram program;
+  CompileVPortActions (actions, actions_len, program);
+  ExecuteVPortActions (swtch, packet_uid, buffer, key, program);
 }
 
 uint16_t
@@ -1334,6 +2306,136 @@ ValidateVPortActions (const ofp_action_header *actions, size_t actions_len)
   return ACT_VALIDATION_OK;
 }
 
+bool
+ActionProgram::CompiledFrom (const ofp_action_header *actions, size_t actions_len) const
+{
+  return source.size () == actions_len
+         && (actions_len == 0 || memcmp (&source[0], actions, actions_len) == 0);
+}
+
+/**
+ * Decode an action list. The list was already validated, so we can be a
+ * bit looser in our sanity-checking. Flow table and port table programs
+ * differ in how the output port and the action type are stored.
+ */
+static void
+CompileActionList (const ofp_action_header *actions, size_t actions_len, ActionProgram& program, bool vport)
+{
+  const uint8_t *p = (const uint8_t *)actions;
+  program.source.assign (p, p + actions_len);
+  program.ops.clear ();
+  program.rewrites = false;
+
+  size_t offset = 0;
+  while (offset + sizeof(ofp_action_header) <= actions_len)
+    {
+      const ofp_action_header *ah = (const ofp_action_header *)(p + offset);
+      size_t len = ntohs (ah->len);
+      if (len == 0)
+        {
+          break;
+        }
+
+      ActionProgram::Op op;
+      op.type = ntohs (ah->type);
+      op.port = -1;
+      op.max_len = 0;
+      op.offset = offset;
+      if (ah->type == htons (OFPAT_OUTPUT))
+        {
+          const ofp_action_output *oa = (const ofp_action_output *)ah;
+          op.kind = ActionProgram::Op::OUTPUT;
+          // port is now 32-bits
+          op.port = vport ? ntohl (oa->port) : oa->port; // ntohl(oa->port);
+          op.max_len = ntohs (oa->max_len);
+          program.ops.push_back (op);
+        }
+      else if (vport)
+        {
+          op.kind = ActionProgram::Op::ACTION;
+          op.type = ah->type; // ntohs(ah->type);
+          program.ops.push_back (op);
+          program.rewrites = true;
+        }
+      else if (Action::IsValidType ((ofp_action_type)op.type))
+        {
+          op.kind = ActionProgram::Op::ACTION;
+          program.ops.push_back (op);
+          program.rewrites = true;
+        }
+      else if (op.type == OFPAT_VENDOR)
+        {
+          op.kind = ActionProgram::Op::VENDOR;
+          program.ops.push_back (op);
+          program.rewrites = true;
+        }
+
+      offset += len;
+    }
+}
+
+void
+CompileActions (const ofp_action_header *actions, size_t actions_len, ActionProgram& program)
+{
+  CompileActionList (actions, actions_len, program, false);
+}
+
+void
+CompileVPortActions (const ofp_action_header *actions, size_t actions_len, ActionProgram& program)
+{
+  CompileActionList (actions, actions_len, program, true);
+}
+
+void
+ExecuteActions (Ptr<OpenFlowSwitchNetDevice> swtch, uint64_t packet_uid, ofpbuf* buffer, sw_flow_key *key, const ActionProgram& program, int ignore_no_fwd)
+{
+  NS_LOG_FUNCTION_NOARGS ();
+  uint16_t in_port = key->flow.in_port; // ntohs(key->flow.in_port);
+
+  if (program.source.empty ())
+    {
+      NS_LOG_INFO ("No actions set to this flow. Dropping packet.");
+      return;
+    }
+
+  // Outputs happen in list order, before any later action modifies the packet.
+  for (std::vector<ActionProgram::Op>::const_iterator op = program.ops.begin (); op != program.ops.end (); op++)
+    {
+      const ofp_action_header *ah = (const ofp_action_header *)&program.source[op->offset];
+      switch (op->kind)
+        {
+        case ActionProgram::Op::OUTPUT:
+          swtch->DoOutput (packet_uid, in_port, op->max_len, op->port, ignore_no_fwd);
+          break;
+        case ActionProgram::Op::ACTION: // Execute a built-in OpenFlow action against 'buffer'.
+          Action::Execute ((ofp_action_type)op->type, buffer, key, ah);
+          break;
+        case ActionProgram::Op::VENDOR:
+          ExecuteVendor (buffer, key, ah);
+          break;
+        }
+    }
+}
+
+void
+ExecuteVPortActions (Ptr<OpenFlowSwitchNetDevice> swtch, uint64_t packet_uid, ofpbuf* buffer, sw_flow_key *key, const ActionProgram& program)
+{
+  uint16_t in_port = ntohs (key->flow.in_port);
+
+  for (std::vector<ActionProgram::Op>::const_iterator op = program.ops.begin (); op != program.ops.end (); op++)
+    {
+      const ofp_action_header *ah = (const ofp_action_header *)&program.source[op->offset];
+      if (op->kind == ActionProgram::Op::OUTPUT)
+        {
+          swtch->DoOutput (packet_uid, in_port, op->max_len, op->port, false);
+        }
+      else
+        {
+          VPortAction::Execute ((ofp_vport_action_type)op->type, buffer, key, ah);
+        }
+    }
+}
+
 void
 ExecuteVendor (ofpbuf *buffer, const sw_flow_key *key, const ofp_action_header *ah)
 {
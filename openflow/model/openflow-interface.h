@@ -29,9 +29,15 @@
 #include "ns3/address.h"
 #include "ns3/nstime.h"
 #include "ns3/mac48-address.h"
+#include "ns3/random-variable-stream.h"
+#include "ns3/traced-value.h"
+#include "ns3/traced-callback.h"
 
+#include <deque>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include <limits>
 
 // Include main header and Vendor Extension files
@@ -98,6 +104,9 @@ void set_mpls_exp (ofpbuf *buffer, sw_flow_key *key, const ofp_action_header *ah
                                 | (1 << OFPAT_SET_MPLS_LABEL)   \
                                 | (1 << OFPAT_SET_MPLS_EXP) )
 
+// Vendor ID of the OFPST_VENDOR statistics this implementation adds.
+#define OFI_VENDOR_ID 0x00ff0053
+
 #define OFP_SUPPORTED_VPORT_TABLE_ACTIONS ( (1 << OFPPAT_OUTPUT)                \
                                             | (1 << OFPPAT_POP_MPLS)            \
                                             | (1 << OFPPAT_PUSH_MPLS)           \
@@ -215,6 +224,47 @@ private:
   int PortStatsDump (Ptr<OpenFlowSwitchNetDevice> dp, PortStatsState *s, ofpbuf *buffer);
 
   int PortTableStatsDump (Ptr<OpenFlowSwitchNetDevice> dp, void *state, ofpbuf *buffer);
+
+  int VendorStatsInit (const void *body, int body_len, void **state);
+  int VendorStatsDump (Ptr<OpenFlowSwitchNetDevice> dp, void *state, ofpbuf *buffer);
+};
+
+/**
+ * \brief Body of the OFPST_VENDOR statistics reply: the packet in meter of
+ * the switch. The request body holds only the vendor ID, OFI_VENDOR_ID.
+ * All fields are in network byte order.
+ */
+struct ofi_packet_in_stats
+{
+  uint32_t vendor;              ///< OFI_VENDOR_ID.
+  uint8_t pad[4];               ///< Align to 64 bits.
+  uint64_t packet_in_count;     ///< Packet ins sent to the controller.
+  uint64_t meter_drop_count;    ///< Packet ins the meter refused, whatever was done with their packets.
+};
+
+/**
+ * \brief Token bucket metering a rate of events, such as packet ins.
+ *
+ * The bucket starts full and refills continuously. The rate and burst are
+ * passed on every use, so that they can stay attributes of the owner.
+ */
+class TokenBucket
+{
+public:
+  TokenBucket ();
+
+  /**
+   * Takes a token, if there is one.
+   *
+   * \param rate Tokens added per second; 0 for no limit.
+   * \param burst Tokens the bucket holds.
+   * \return true if a token was taken; always true without a rate.
+   */
+  bool Take (double rate, uint32_t burst);
+
+private:
+  double m_tokens;      ///< Tokens left; negative until first used.
+  Time m_lastFill;      ///< Time the tokens were last refilled.
 };
 
 /**
@@ -337,6 +387,36 @@ struct SwitchPacketMetadata
   Address dst;             ///< Destination Address of the Packet when the Packet is received.
 };
 
+/**
+ * \brief A flow mod in host byte order.
+ *
+ * Controllers running in the same simulation as their switches hand this to
+ * OpenFlowSwitchNetDevice::InstallFlow instead of encoding an ofp_flow_mod.
+ * Nothing is allocated for it; the actions are only copied if a flow is added.
+ */
+struct FlowSpec
+{
+  FlowSpec ();
+
+  /**
+   * Sets the match, and the network masks the flow table derives from the wildcards.
+   *
+   * \param f The header fields to match, as flow_extract fills them in.
+   * \param wildcards The OFPFW_* flags of the fields to ignore, in host order.
+   */
+  void SetMatch (const flow& f, uint32_t wildcards);
+
+  uint16_t command;                     ///< OFPFC_* command.
+  sw_flow_key key;                      ///< Match, as the flow table keeps it; see SetMatch.
+  uint16_t priority;                    ///< Priority of a wildcarded flow.
+  uint16_t idle_timeout;                ///< Seconds the flow may stay unused, or OFP_FLOW_PERMANENT.
+  uint16_t hard_timeout;                ///< Seconds the flow may live, or OFP_FLOW_PERMANENT.
+  uint32_t buffer_id;                   ///< Buffered packet to run through the flow, or -1.
+  uint16_t out_port;                    ///< Deletes only remove flows outputting here, unless OFPP_NONE.
+  const ofp_action_header *actions;     ///< Actions, laid out as in a flow mod with output ports unconverted.
+  size_t actions_len;                   ///< Length of the actions.
+};
+
 /**
  * \brief An interface for a Controller of OpenFlowSwitchNetDevices
  *
@@ -350,6 +430,7 @@ public:
    * \return The TypeId.
    */
   static TypeId GetTypeId (void);
+  Controller ();
   /** Destructor. */
   virtual ~Controller ();
 
@@ -390,29 +471,147 @@ public:
   void StartDump (StatsDumpCallback* cb);
 
   /**
-  *
-  */
-  virtual void create_path(Mac48Address,std::map<uint32_t,Mac48Address>,std::map<uint32_t,Mac48Address>,uint32_t)
+   * Called when a switch reports that one of its ports changed status, e.g.
+   * because its link went down or came back up. Switches report link changes
+   * as soon as they happen, so a controller can reroute from here without
+   * waiting for traffic to hit the dead port. The message still goes to
+   * ReceiveFromSwitch afterwards.
+   *
+   * \param swtch The switch the port belongs to.
+   * \param ops The port status message.
+   */
+  virtual void PortStatusChanged (Ptr<OpenFlowSwitchNetDevice> swtch, const ofp_port_status *ops)
+  {
+  }
+
+  /**
+   * Registers a switch and its links with the controller.
+   *
+   * \param switchid Address of the switch.
+   * \param switchlist Neighbour switches, by the port of the switch leading to them.
+   * \param nodelist Attached hosts, by the port of the switch leading to them.
+   * \param high_traffic_flag 1 if the switch carries high traffic and slow flows should avoid it.
+   */
+  virtual void create_path(Mac48Address,const std::map<uint32_t,Mac48Address>&,const std::map<uint32_t,Mac48Address>&,uint32_t)
   {}
 
+  /**
+   * Tells the controller that every switch has been registered through
+   * create_path, so it can compute its routes once for the whole topology.
+   * Controllers that are never told compute them when they first need them.
+   */
+  virtual void FinalizeTopology (void)
+  {
+  }
+
+  /// How the input queue orders waiting messages and picks the ones to drop.
+  enum QueueDiscipline
+  {
+    TAIL_DROP,  ///< First come, first served; a message that finds the queue full is dropped.
+    PRIORITY    ///< Other messages are served before packet ins, and push the newest packet in out of a full queue.
+  };
+
+  /**
+   * A switch calls this method to hand a message to the controller. Without
+   * a processing time the message is handled straight away; otherwise it
+   * waits in the input queue and is handled once the controller is done
+   * processing it. Port status messages go to PortStatusChanged, then every
+   * message goes to ReceiveFromSwitch.
+   *
+   * \param swtch The switch the message was received from.
+   * \param buffer The message; copied if it has to wait.
+   */
+  void EnqueueFromSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer);
+
+  /**
+   * Overrides the ProcessingTime attribute for one type of message.
+   *
+   * \param type The OFPT_* message type.
+   * \param time Seconds it takes to process a message of this type.
+   */
+  void SetProcessingTime (uint8_t type, Ptr<RandomVariableStream> time);
+
+  /**
+   * Assigns fixed random variable stream numbers to the processing times.
+   *
+   * \param stream First stream index to use.
+   * \return The number of stream indices assigned.
+   */
+  int64_t AssignStreams (int64_t stream);
+
+  /// \return Number of messages waiting in the input queue, besides the one being processed.
+  uint32_t GetQueueLength (void) const;
+
+  /// \return Number of messages dropped from the input queue.
+  uint64_t GetQueueDrops (void) const;
+
+  /// \return Number of packet ins over the PacketInRate of the controller, dropped on arrival.
+  uint64_t GetAdmissionDrops (void) const;
+
+  /**
+   * TracedCallback signature for a message dropped from the input queue.
+   *
+   * \param [in] swtch The switch the message came from.
+   * \param [in] type The OFPT_* message type.
+   */
+  typedef void (* DropTracedCallback)(Ptr<OpenFlowSwitchNetDevice> swtch, uint8_t type);
 
 protected:
+  virtual void DoDispose (void);
+
   /**
    * However the controller is implemented, this method is to
    * be used to pass a message on to a switch.
    *
    * \param swtch The switch to receive the message.
-   * \param msg The message to send.
+   * \param msg The message to send; still the caller's to free once this returns.
    * \param length The length of the message.
    */
   virtual void SendToSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, void * msg, size_t length);
 
+  /**
+   * Adds, modifies or deletes flows in a switch: directly if NativeControl
+   * is set, as an OFPT_FLOW_MOD message through SendToSwitch otherwise.
+   *
+   * \param swtch The switch.
+   * \param spec The flow mod.
+   */
+  void SendFlow (Ptr<OpenFlowSwitchNetDevice> swtch, const FlowSpec& spec);
+
+  /**
+   * Runs a list of actions on a packet buffered by a switch: directly if
+   * NativeControl is set, as an OFPT_PACKET_OUT message otherwise.
+   *
+   * \param swtch The switch.
+   * \param buffer_id The OpenFlow Buffer ID, in host order.
+   * \param in_port The port the packet was received over.
+   * \param acts List of actions to execute.
+   * \param actions_len Length of the actions buffer.
+   */
+  void SendPacketOut (Ptr<OpenFlowSwitchNetDevice> swtch, uint32_t buffer_id, uint16_t in_port, const void* acts, size_t actions_len);
+
+  /**
+   * Runs a list of actions on a packet built by the controller; over the
+   * wire the packet is serialized behind an Ethernet header.
+   *
+   * \param swtch The switch.
+   * \param packet The packet, without its Ethernet header.
+   * \param protocol The protocol number of the packet.
+   * \param src The source address of the packet.
+   * \param dst The destination address of the packet.
+   * \param in_port The port the packet counts as received over.
+   * \param acts List of actions to execute.
+   * \param actions_len Length of the actions buffer.
+   */
+  void SendPacketOut (Ptr<OpenFlowSwitchNetDevice> swtch, Ptr<Packet> packet, uint16_t protocol, Mac48Address src, Mac48Address dst,
+                      uint16_t in_port, const void* acts, size_t actions_len);
+
   /**
    * Construct flow data from a matching key to build a flow
    * entry for adding, modifying, or deleting a flow.
    *
    * \param key The matching key data; used to create a flow that matches the packet.
-   * \param buffer_id The OpenFlow Buffer ID; used to run the actions on the packet if we add or modify the flow.
+   * \param buffer_id The OpenFlow Buffer ID, in host order; used to run the actions on the packet if we add or modify the flow.
    * \param command Whether to add, modify, or delete this flow.
    * \param acts List of actions to execute.
    * \param actions_len Length of the actions buffer.
@@ -422,6 +621,22 @@ protected:
    */
   ofp_flow_mod* BuildFlow (sw_flow_key key, uint32_t buffer_id, uint16_t command, void* acts, size_t actions_len, int idle_timeout, int hard_timeout);
 
+  /**
+   * Construct a packet out message that runs a list of actions on a
+   * packet buffered by the switch, or on a frame carried in the message
+   * when buffer_id is -1.
+   *
+   * \param buffer_id The OpenFlow Buffer ID, in host order, or -1.
+   * \param in_port The port the packet was received over.
+   * \param acts List of actions to execute.
+   * \param actions_len Length of the actions buffer.
+   * \param data The Ethernet frame to send when the packet isn't buffered.
+   * \param data_len Length of the frame.
+   * \return The message; free it once sent.
+   */
+  ofp_packet_out* BuildPacketOut (uint32_t buffer_id, uint16_t in_port, void* acts, size_t actions_len,
+                                  const uint8_t* data = 0, size_t data_len = 0);
+
   /**
    * Get the packet type on the buffer, which can then be used
    * to determine how to handle the buffer.
@@ -433,6 +648,69 @@ protected:
 
   typedef std::set<Ptr<OpenFlowSwitchNetDevice> > Switches_t;
   Switches_t m_switches;  ///< The collection of switches registered to this controller.
+  bool m_nativeControl;   ///< Whether flow mods and packet outs skip the OpenFlow wire format.
+
+private:
+  /// A message in the input queue.
+  struct QueuedMessage
+  {
+    Ptr<OpenFlowSwitchNetDevice> swtch; ///< The switch the message came from.
+    ofpbuf *buffer;                     ///< Copy of the message.
+    uint8_t type;                       ///< OFPT_* message type.
+    Time arrival;                       ///< Time the message reached the controller.
+  };
+
+  /// \return true if messages are handled as soon as they arrive.
+  bool IsInstant (void) const;
+
+  /**
+   * \param type The OFPT_* message type.
+   * \return Time it takes to process the next message of this type.
+   */
+  Time GetProcessingTime (uint8_t type);
+
+  /// Starts processing the first waiting message.
+  void StartProcessing (void);
+
+  /// The message being processed is done; hands it to HandleFromSwitch.
+  void ProcessingComplete (void);
+
+  /**
+   * Hands a message to PortStatusChanged if it is a port status, then to ReceiveFromSwitch.
+   *
+   * \param swtch The switch the message was received from.
+   * \param buffer The message.
+   */
+  void HandleFromSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer);
+
+  /**
+   * Drops a message from the input queue.
+   *
+   * \param message The message.
+   */
+  void DropMessage (QueuedMessage& message);
+
+  /// Updates the QueueDepth trace from the queues.
+  void UpdateQueueDepth (void);
+
+  typedef std::map<uint8_t, Ptr<RandomVariableStream> > ProcessingTimes_t;
+  Ptr<RandomVariableStream> m_processingTime;   ///< Processing time of every message, unless overridden by type.
+  ProcessingTimes_t m_typeProcessingTime;       ///< Processing times by message type.
+  uint32_t m_queueSize;                         ///< Messages the input queue holds; 0 for no limit.
+  QueueDiscipline m_queueDiscipline;            ///< How the input queue is served.
+  std::deque<QueuedMessage> m_urgent;           ///< Waiting messages served before m_queue under PRIORITY.
+  std::deque<QueuedMessage> m_queue;            ///< Waiting messages, in arrival order.
+  QueuedMessage m_current;                      ///< Message being processed.
+  bool m_busy;                                  ///< Whether m_current is being processed.
+  EventId m_processingEvent;                    ///< End of processing of m_current.
+  uint64_t m_queueDrops;                        ///< Messages dropped from the input queue.
+  double m_packetInRate;                        ///< Packet ins admitted per second from all switches; 0 for no limit.
+  uint32_t m_packetInBurst;                     ///< Packet ins admitted at once.
+  TokenBucket m_packetInMeter;                  ///< Admission of packet ins.
+  uint64_t m_admissionDrops;                    ///< Packet ins refused admission.
+  TracedValue<uint32_t> m_queueDepth;           ///< Messages waiting in the input queue.
+  TracedCallback<Time> m_sojournTrace;          ///< Time from arrival to the end of processing.
+  TracedCallback<Ptr<OpenFlowSwitchNetDevice>, uint8_t> m_dropTrace; ///< Messages dropped from the input queue.
 };
 
 /**
@@ -468,49 +746,287 @@ public:
    */
   static TypeId GetTypeId (void);
 
+  LearningController ()
+    : m_proactive (false),
+      m_aggregateFlows (false),
+      m_proxyArp (false),
+      m_addressStride (0),
+      m_routesStale (false)
+  {
+  }
+
   virtual ~LearningController ()
   {
-    m_LearnStateSwitchMap.clear();
-    m_LearnStateSwitchMapSlow.clear();
+    m_nextHop[FAST].clear ();
+    m_nextHop[SLOW].clear ();
   }
 
   void ReceiveFromSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer);
 
+  /**
+   * Deletes the flows of the switch that output to a port whose link went
+   * down. A switch of the registered topology gets its routes and flood
+   * tree recomputed around the link, and again once it comes back up, and
+   * the flood flows are reinstalled; any other switch forgets the addresses
+   * learned over the port.
+   *
+   * \param swtch The switch the port belongs to.
+   * \param ops The port status message.
+   */
+  void PortStatusChanged (Ptr<OpenFlowSwitchNetDevice> swtch, const ofp_port_status *ops);
+
+  /**
+   * Looks up the port a switch forwards traffic for an address to, as
+   * computed from the registered topology or learned since.
+   *
+   * \param switchid Address of the switch.
+   * \param dst Destination address.
+   * \param slow Look up the route of slow flows, which avoids high traffic switches.
+   * \param port Set to the output port if there is a route.
+   * \return true if there is a route.
+   */
+  bool LookupRoute (Mac48Address switchid, Mac48Address dst, bool slow, uint32_t *port);
+
+  /**
+   * Looks up every port a switch has on a shortest path to an address;
+   * reactive flows are spread over them by a hash of their 5-tuple.
+   *
+   * \param switchid Address of the switch.
+   * \param dst Destination address.
+   * \param slow Look up the routes of slow flows, which avoid high traffic switches.
+   * \param ports Filled with the output ports, the one LookupRoute returns first.
+   * \return The number of ports found.
+   */
+  size_t LookupEqualCostRoutes (Mac48Address switchid, Mac48Address dst, bool slow, std::vector<uint16_t> *ports);
+
+  /**
+   * Computes the routes of the switches registered so far.
+   */
+  void FinalizeTopology (void);
+
 protected:
-  struct LearnedState
+  /// Routing planes: every switch carries fast flows, slow flows avoid the high traffic switches.
+  enum Plane
   {
-    uint32_t port;                      ///< Learned port.
-    int32_t dist=-1;                    ///< Distance measure 
+    FAST = 0,
+    SLOW = 1
   };
+  static const uint16_t NO_ROUTE = 0xffff; ///< Next hop of a destination with no route.
+  static const uint32_t NO_EQUAL_COST = 0xffffffff; ///< Equal cost set of a destination with a single path.
+
+  /// Hashes a MAC address for the address indices.
+  struct Mac48AddressHash
+  {
+    size_t operator() (const Mac48Address& address) const
+    {
+      uint8_t bytes[6];
+      address.CopyTo (bytes);
+      uint64_t value = 0;
+      for (int i = 0; i < 6; i++)
+        {
+          value = (value << 8) | bytes[i];
+        }
+      return std::hash<uint64_t> () (value);
+    }
+  };
+
   Time m_expirationTime;                ///< Time it takes for learned MAC state entry/created flow to expire.
-  typedef std::map<Mac48Address, LearnedState> LearnState_t;
-  typedef std::map<Mac48Address, LearnState_t> LearnStateSwitchMap_t;//Learn State Data
-  typedef std::map<Mac48Address, uint32_t > LastbroadcastportMap_t;//broadcast Source Data
-  typedef std::map<Mac48Address, std::set<uint32_t> > PortList_t;  //List of Active Ports in switch
-  typedef std::set<Mac48Address> SlowSwitchList_t;//List of High Traffic Switchs
-
-  LearnStateSwitchMap_t m_LearnStateSwitchMap,m_LearnStateSwitchMapSlow;
-  PortList_t m_allPortList,m_slowPortList;
-  SlowSwitchList_t m_slowSwitchList;
-  LastbroadcastportMap_t m_lastbroadcastMapport;
-  
+  bool m_proactive;                     ///< Whether routes are installed in the switches as soon as they're computed.
+  bool m_aggregateFlows;                ///< Whether flows match only the destination address when that decides the route.
+  bool m_proxyArp;                      ///< Whether ARP requests for known addresses are answered by the controller.
+  std::unordered_map<uint32_t, Mac48Address> m_arpTable; ///< MAC address of every IPv4 address seen, for proxy ARP.
+  typedef std::unordered_map<Mac48Address, uint32_t, Mac48AddressHash> AddressIndex_t;
+  AddressIndex_t m_switchIndex;         ///< Dense index of every switch seen.
+  AddressIndex_t m_addressIndex;        ///< Dense index of every destination address seen.
+  uint32_t m_addressStride;             ///< Row length of the next-hop tables; at least the number of addresses.
+  std::vector<uint16_t> m_nextHop[2];   ///< Output port by plane, switch row and destination column; NO_ROUTE if unknown.
+  std::unordered_map<uint64_t, uint32_t> m_equalCost[2]; ///< Start of the equal cost set in m_equalCostPorts by plane, for each switch << 32 | address index with several next hops.
+  std::vector<uint16_t> m_equalCostPorts[2]; ///< Equal cost sets by plane: a count, then the ports; the destinations behind one switch share theirs.
+  std::set<uint64_t> m_aggregated;      ///< Destination flows sent to the switches, by switch index << 32 | address index; cleared when one still misses.
+  std::vector<std::vector<uint16_t> > m_floodTree; ///< Ports of each switch, by index, that broadcasts go out on.
+
+  /// A switch registered through create_path, with its links.
+  struct TopologySwitch
+  {
+    std::map<uint32_t, Mac48Address> switches; ///< Neighbour switches, by port.
+    std::map<uint32_t, Mac48Address> hosts;    ///< Attached hosts, by port.
+    bool highTraffic;                          ///< Whether slow flows avoid this switch.
+  };
+  typedef std::map<Mac48Address, TopologySwitch> Topology_t;
+  Topology_t m_topology;                ///< Registered switches.
+  bool m_routesStale;                   ///< Whether the topology changed since the routes were computed.
+  std::set<std::pair<uint32_t, uint16_t> > m_downPorts; ///< Ports of registered switches reported down, by switch index; routes avoid their links.
+
   /**
-  *This 
-  */
-  void create_path_helper(Mac48Address switchid,std::map<uint32_t,Mac48Address>switchlist,std::map<uint32_t,Mac48Address>nodelist,LearnStateSwitchMap_t *switchmap);
-  
+   * Records a switch and its links; routes are computed on first use.
+   */
+  void create_path(Mac48Address,const std::map<uint32_t,Mac48Address>&,const std::map<uint32_t,Mac48Address>&,uint32_t);
+
   /**
-  *
-  */
-  void create_path(Mac48Address,std::map<uint32_t,Mac48Address>,std::map<uint32_t,Mac48Address>,uint32_t);
-  
+   * Computes the routes of both planes if the topology changed.
+   */
+  void UpdateRoutes (void);
+
+  /**
+   * Computes the shortest path routes from every switch to every host with
+   * one breadth-first search per switch hosts are attached to, keeping every
+   * next hop of equal cost, over the links that are up. Whatever the plane
+   * had learned from traffic is dropped.
+   *
+   * \param plane The routing plane to fill; the slow plane leaves the high traffic switches out.
+   */
+  void ComputeRoutes (Plane plane);
+
+  /**
+   * Installs a flow per host in every switch, matching only the destination
+   * address and outputting on the port of its route, along with the flow
+   * flooding broadcasts over the spanning tree. A host the two planes route
+   * differently only gets a flow for ARP, which always takes the fast plane;
+   * its other packets, and those of hosts with several equal cost routes,
+   * are left to miss, so they get the flows of their plane and path.
+   */
+  void InstallRoutes (void);
+
+  /**
+   * Computes a spanning tree of every connected group of switches with a
+   * breadth-first search, and keeps for each switch its tree and host ports.
+   * Links and host ports reported down are left out.
+   */
+  void ComputeFloodTree (void);
+
   /**
-  *This
-  */
-  void setaddress(Mac48Address switchid,Mac48Address oldswitchid,LearnStateSwitchMap_t *);
+   * Finds the far end of a link between two registered switches. Parallel
+   * links are told apart by the channel the two ports share when both
+   * switches are connected to the controller; otherwise the k-th link of a
+   * switch to its neighbour is the neighbour's k-th link back, in port order.
+   *
+   * \param sw The switch.
+   * \param port The port of the switch the link is on.
+   * \return The port of the neighbour on the link, NO_ROUTE if it lists none back.
+   */
+  uint16_t GetPeerPort (Topology_t::const_iterator sw, uint16_t port) const;
+
+  /**
+   * \param sw The switch.
+   * \param port A port of the switch leading to another switch.
+   * \return false if either end of the link was reported down.
+   */
+  bool IsLinkUp (Topology_t::const_iterator sw, uint16_t port) const;
+
+  /**
+   * Installs the flow that floods broadcasts over the spanning tree in a
+   * switch, or over all its ports if the switch isn't part of the topology.
+   *
+   * \param swtch The switch.
+   * \param buffer_id The OpenFlow Buffer ID of a broadcast to send out, or -1.
+   */
+  void InstallFloodFlow (Ptr<OpenFlowSwitchNetDevice> swtch, uint32_t buffer_id);
+
+  /**
+   * \param swtch The switch.
+   * \return The actions that flood a broadcast over the spanning tree in the switch.
+   */
+  std::vector<ofp_action_output> GetFloodActions (Ptr<OpenFlowSwitchNetDevice> swtch);
+
+  /**
+   * Learns the addresses of the sender of an ARP packet, and answers it on
+   * behalf of the target if it is a request for an address already known;
+   * an unknown target gets the request flooded over the spanning tree,
+   * without a flow so the next request comes back to the controller.
+   *
+   * \param swtch The switch the packet missed in.
+   * \param buffer The Ethernet frame of the packet.
+   * \param buffer_id The OpenFlow Buffer ID of the packet, or -1 if the switch
+   *        didn't keep it; the frame is flooded then.
+   * \param in_port The port the packet was received over.
+   * \return false if the packet isn't a request, in which case it is left to be forwarded as usual.
+   */
+  bool HandleArp (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer, uint32_t buffer_id, uint16_t in_port);
+
+  /**
+   * Forwards a packet that missed in a switch with a flow that matches only
+   * its destination address, when that is all the route depends on: the
+   * destination is routed the same way on both planes. The flow is only
+   * installed once per switch and destination; the next miss, e.g. a packet
+   * that was already queued, is sent out with a packet out message, and the
+   * one after that installs the flow again in case it never made it.
+   *
+   * \param swtch The switch the packet missed in.
+   * \param dst The destination address of the packet.
+   * \param buffer_id The OpenFlow Buffer ID of the packet.
+   * \param in_port The port the packet was received over.
+   * \return false if the route depends on more than the destination, in which case nothing is sent.
+   */
+  bool ForwardAggregated (Ptr<OpenFlowSwitchNetDevice> swtch, Mac48Address dst, uint32_t buffer_id, uint16_t in_port);
+
+  /**
+   * Forgets the destination flows a switch no longer holds, after a flow expired or was flushed.
+   *
+   * \param swtch The switch.
+   * \param dst The destination whose flow is gone, or the broadcast address for all of them.
+   */
+  void ForgetAggregated (Ptr<OpenFlowSwitchNetDevice> swtch, Mac48Address dst);
+
+  /**
+   * \param switchid Address of a switch.
+   * \return The index of the switch; a new switch gets a row in both planes.
+   */
+  uint32_t GetSwitchIndex (Mac48Address switchid);
+
+  /**
+   * \param address A destination address.
+   * \return The index of the address; a new address gets a column in both planes.
+   */
+  uint32_t GetAddressIndex (Mac48Address address);
 
+  /**
+   * \param plane The routing plane.
+   * \param sw Index of the switch.
+   * \param dst Index of the destination address.
+   * \return The output port the switch uses for the destination, NO_ROUTE if unknown.
+   */
+  uint16_t& NextHop (Plane plane, uint32_t sw, uint32_t dst)
+  {
+    return m_nextHop[plane][sw * m_addressStride + dst];
+  }
+
+  /**
+   * \param plane The routing plane.
+   * \param sw Index of the switch.
+   * \param dst Index of the destination address.
+   * \return Where the shortest path ports of the destination start in
+   * m_equalCostPorts, NO_EQUAL_COST if there is only the next hop.
+   */
+  uint32_t EqualCost (Plane plane, uint32_t sw, uint32_t dst) const
+  {
+    std::unordered_map<uint64_t, uint32_t>::const_iterator it = m_equalCost[plane].find (((uint64_t)sw << 32) | dst);
+    return it != m_equalCost[plane].end () ? it->second : NO_EQUAL_COST;
+  }
+
+  /**
+   * Picks the output port of a flow among the equal cost next hops of its
+   * destination with a hash of its 5-tuple, so that every packet of the
+   * flow takes the same path.
+   *
+   * \param plane The routing plane.
+   * \param sw Index of the switch.
+   * \param dst Index of the destination address.
+   * \param key The flow.
+   * \return The output port, NO_ROUTE if unknown.
+   */
+  uint16_t SelectNextHop (Plane plane, uint32_t sw, uint32_t dst, const sw_flow_key& key);
 };
 
+/**
+ * \brief Current simulation time in whole seconds.
+ *
+ * Flow timestamps (created, used) are kept on this clock rather than on
+ * OFSID's time_now (), which reads the wall clock.
+ *
+ * \return Seconds since the start of the simulation.
+ */
+uint64_t FlowTimeNow (void);
+
 /**
  * \brief Executes a list of flow table actions.
  *
@@ -555,6 +1071,83 @@ void ExecuteVPortActions (Ptr<OpenFlowSwitchNetDevice> swtch, uint64_t packet_ui
  */
 uint16_t ValidateVPortActions (const ofp_action_header *actions, size_t actions_len);
 
+/**
+ * \brief An action list decoded ahead of time.
+ *
+ * Executing a program doesn't parse the action list again: lengths and types
+ * are swapped once, output ports are resolved, and the set-field actions
+ * point at their copy of the action for the OFSID helpers that apply them.
+ */
+struct ActionProgram
+{
+  /// A decoded action.
+  struct Op
+  {
+    enum Kind
+    {
+      OUTPUT,                   ///< Forward the packet; port and max_len are set.
+      ACTION,                   ///< Built-in flow table or port table action; type is set.
+      VENDOR                    ///< Vendor-defined action.
+    } kind;
+    uint16_t type;              ///< Action type, in host order.
+    int port;                   ///< Output port.
+    size_t max_len;             ///< Bytes to send if the output port is the controller.
+    size_t offset;              ///< Offset of the action in the program's copy of the action list.
+  };
+
+  std::vector<uint8_t> source;  ///< Copy of the action list the program was compiled from.
+  std::vector<Op> ops;          ///< Decoded actions, in order.
+  bool rewrites;                ///< Whether any action besides output may modify the packet.
+
+  /**
+   * \param actions A buffer of actions.
+   * \param actions_len Length of actions buffer.
+   * \return true if the program was compiled from this very action list.
+   */
+  bool CompiledFrom (const ofp_action_header *actions, size_t actions_len) const;
+};
+
+/**
+ * \brief Compiles a validated list of flow table actions.
+ *
+ * \param actions A buffer of actions.
+ * \param actions_len Length of actions buffer.
+ * \param program The program to fill.
+ */
+void CompileActions (const ofp_action_header *actions, size_t actions_len, ActionProgram& program);
+
+/**
+ * \brief Compiles a validated list of virtual port table entry actions.
+ *
+ * \param actions A buffer of actions.
+ * \param actions_len Length of actions buffer.
+ * \param program The program to fill.
+ */
+void CompileVPortActions (const ofp_action_header *actions, size_t actions_len, ActionProgram& program);
+
+/**
+ * \brief Executes a compiled list of flow table actions.
+ *
+ * \param swtch OpenFlowSwitchNetDevice these actions are being executed on.
+ * \param packet_uid Packet UID; used to fetch the packet and its metadata.
+ * \param buffer The Packet OpenFlow buffer; may be 0 if the program doesn't rewrite the packet.
+ * \param key The matching key for the flow tied to this list of actions.
+ * \param program The compiled actions.
+ * \param ignore_no_fwd If true, during port forwarding actions, ports that are set to not forward are forced to forward.
+ */
+void ExecuteActions (Ptr<OpenFlowSwitchNetDevice> swtch, uint64_t packet_uid, ofpbuf* buffer, sw_flow_key *key, const ActionProgram& program, int ignore_no_fwd);
+
+/**
+ * \brief Executes a compiled list of virtual port table entry actions.
+ *
+ * \param swtch OpenFlowSwitchNetDevice these actions are being executed on.
+ * \param packet_uid Packet UID; used to fetch the packet and its metadata.
+ * \param buffer The Packet OpenFlow buffer.
+ * \param key The matching key for the flow tied to this list of actions.
+ * \param program The compiled actions.
+ */
+void ExecuteVPortActions (Ptr<OpenFlowSwitchNetDevice> swtch, uint64_t packet_uid, ofpbuf* buffer, sw_flow_key *key, const ActionProgram& program);
+
 /**
  * \brief Executes a vendor-defined action.
  *
@@ -581,6 +1174,9 @@ uint16_t ValidateVendor (const sw_flow_key *key, const ofp_action_header *ah, ui
  * is an index into an array of buffers.  The cookie distinguishes between
  * different packets that have occupied a single buffer.  Thus, the more
  * buffers we have, the lower-quality the cookie...
+ *
+ * Each OpenFlowSwitchNetDevice keeps its own buffer store; PKT_BUFFER_BITS is
+ * the default of its BufferSlotBits attribute.
  */
 
 
@@ -18,8 +18,8 @@
 #ifdef NS3_OPENFLOW
 
 #include "openflow-switch-net-device.h"
-#include "ns3/udp-l4-protocol.h"
-#include "ns3/tcp-l4-protocol.h"
+#include "openflow-tuple-space-table.h"
+#include <algorithm>
 
 namespace ns3 {
 
@@ -59,6 +59,106 @@ GenerateId ()
   return eth_addr_to_uint64 (ea);
 }
 
+/**
+ * FNV-1a hash over the exact-match fields of a flow key. flow_extract clears
+ * the whole structure before filling it, so padding bytes are deterministic.
+ */
+static uint32_t
+HashFlowKey (const flow *f)
+{
+  const uint8_t *p = (const uint8_t *)f;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < sizeof *f; i++)
+    {
+      hash ^= p[i];
+      hash *= 16777619u;
+    }
+  return hash;
+}
+
+/**
+ * Write the Ethernet header the receiving NetDevice stripped off a packet.
+ */
+static void
+FillEthHeader (eth_header *eth_h, const Address& src, const Address& dst, uint16_t protocol)
+{
+  dst.CopyTo (eth_h->eth_dst);              // Destination Mac Address
+  src.CopyTo (eth_h->eth_src);              // Source Mac Address
+  eth_h->eth_type = htons (protocol);       // Ether Type
+}
+
+/**
+ * \return Length of the frame of a buffered packet, whether its OpenFlow buffer was built or not.
+ */
+static size_t
+FrameSize (const ofi::SwitchPacketMetadata& data)
+{
+  return data.buffer != 0 ? data.buffer->size : ETH_HEADER_LEN + data.packet->GetSize ();
+}
+
+/**
+ * \return Second at which a flow times out, idle or hard, given when it was last used.
+ */
+static uint64_t
+FlowDeadline (const sw_flow *flow)
+{
+  uint64_t deadline = std::numeric_limits<uint64_t>::max ();
+  if (flow->hard_timeout != OFP_FLOW_PERMANENT)
+    {
+      deadline = flow->created + flow->hard_timeout;
+    }
+  if (flow->idle_timeout != OFP_FLOW_PERMANENT)
+    {
+      deadline = std::min (deadline, (uint64_t)(flow->used + flow->idle_timeout));
+    }
+  return deadline;
+}
+
+/// A flow a strict delete would remove, while looking for it.
+struct StrictMatch
+{
+  const sw_flow_key *key;  ///< Match, wildcards included.
+  uint16_t priority;       ///< Priority.
+  sw_flow *flow;           ///< The flow found, or 0.
+};
+
+/**
+ * Table iteration callback stopping at the flow a strict delete would remove.
+ */
+static int
+FindStrictMatch (sw_flow *flow, void *aux)
+{
+  StrictMatch *match = (StrictMatch*)aux;
+  if (flow->priority == match->priority && flow_del_matches (&flow->key, match->key, 1))
+    {
+      match->flow = flow;
+      return 1;
+    }
+  return 0;
+}
+
+/// The flows a loose delete would remove, while collecting them.
+struct LooseMatch
+{
+  const sw_flow_key *key;        ///< Match, wildcards included.
+  uint16_t out_port;             ///< Output port the flows must have, or OFPP_NONE.
+  std::vector<sw_flow*> flows;   ///< The flows found.
+};
+
+/**
+ * Table iteration callback collecting the flows a loose delete would remove.
+ */
+static int
+CollectLooseMatch (sw_flow *flow, void *aux)
+{
+  LooseMatch *match = (LooseMatch*)aux;
+  if (flow_del_matches (&flow->key, match->key, 0) && flow_has_out_port (flow, match->out_port))
+    {
+      match->flows.push_back (flow);
+    }
+  return 0;
+}
+
 TypeId
 OpenFlowSwitchNetDevice::GetTypeId (void)
 {
@@ -86,6 +186,65 @@ OpenFlowSwitchNetDevice::GetTypeId (void)
                    UintegerValue (OFP_DEFAULT_MISS_SEND_LEN), // 128 bytes
                    MakeUintegerAccessor (&OpenFlowSwitchNetDevice::m_missSendLen),
                    MakeUintegerChecker<uint16_t> ())
+    .AddAttribute ("FlowCacheSize",
+                   "Number of entries in the exact-match flow cache consulted before the flow table. A value of 0 disables the cache.",
+                   UintegerValue (1024),
+                   MakeUintegerAccessor (&OpenFlowSwitchNetDevice::m_flowCacheSize),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("BufferSlotBits",
+                   "Number of low bits of a buffer_id that select the packet buffer slot; the switch buffers 2^n packets for the controller and the remaining bits form a cookie. Set before the first packet is received.",
+                   UintegerValue (PKT_BUFFER_BITS), // 256 packets
+                   MakeUintegerAccessor (&OpenFlowSwitchNetDevice::m_bufferSlotBits),
+                   MakeUintegerChecker<uint32_t> (1, 24))
+    .AddAttribute ("ControlDelay",
+                   "One-way propagation delay of the control connection. With neither delay nor data rate, control messages cross it instantly.",
+                   TimeValue (Seconds (0)),
+                   MakeTimeAccessor (&OpenFlowSwitchNetDevice::SetControlDelay,
+                                     &OpenFlowSwitchNetDevice::GetControlDelay),
+                   MakeTimeChecker ())
+    .AddAttribute ("ControlDataRate",
+                   "Data rate of each direction of the control connection; 0 sends messages without serialization delay.",
+                   DataRateValue (DataRate (0)),
+                   MakeDataRateAccessor (&OpenFlowSwitchNetDevice::SetControlDataRate,
+                                         &OpenFlowSwitchNetDevice::GetControlDataRate),
+                   MakeDataRateChecker ())
+    .AddAttribute ("ControlQueueSize",
+                   "Number of messages each direction of the control connection holds while they wait or are sent; "
+                   "further messages are dropped. 0 for no limit.",
+                   UintegerValue (100),
+                   MakeUintegerAccessor (&OpenFlowSwitchNetDevice::SetControlQueueSize,
+                                         &OpenFlowSwitchNetDevice::GetControlQueueSize),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("PendingMissQueueSize",
+                   "Number of packets of a flow held back while its first packet that missed the flow table is with the controller; "
+                   "they go through the flow the controller adds instead of reaching it as packet ins. "
+                   "Further packets are sent to the controller. 0 sends every miss to the controller.",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&OpenFlowSwitchNetDevice::m_pendingMissQueueSize),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("PendingMissTimeout",
+                   "Time held back packets wait for the controller to add a flow covering them, "
+                   "e.g. because it answered with a packet out only or the packet in was lost. "
+                   "They are then forwarded if a flow matches them, and sent to the controller otherwise.",
+                   TimeValue (MilliSeconds (100)),
+                   MakeTimeAccessor (&OpenFlowSwitchNetDevice::m_pendingMissTimeout),
+                   MakeTimeChecker ())
+    .AddAttribute ("PacketInRate",
+                   "Packet ins per second the switch sends to the controller, whatever the reason; 0 for no limit.",
+                   DoubleValue (0),
+                   MakeDoubleAccessor (&OpenFlowSwitchNetDevice::m_packetInRate),
+                   MakeDoubleChecker<double> (0))
+    .AddAttribute ("PacketInBurst",
+                   "Packet ins the switch sends at once, before PacketInRate limits them.",
+                   UintegerValue (100),
+                   MakeUintegerAccessor (&OpenFlowSwitchNetDevice::m_packetInBurst),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("PacketInOverflow",
+                   "What the switch does with a table miss over PacketInRate.",
+                   EnumValue (OVERFLOW_DROP),
+                   MakeEnumAccessor (&OpenFlowSwitchNetDevice::m_packetInOverflow),
+                   MakeEnumChecker (OVERFLOW_DROP, "Drop",
+                                    OVERFLOW_FLOOD, "Flood"))
   ;
   return tid;
 }
@@ -93,13 +252,28 @@ OpenFlowSwitchNetDevice::GetTypeId (void)
 OpenFlowSwitchNetDevice::OpenFlowSwitchNetDevice ()
   : m_node (0),
     m_ifIndex (0),
-    m_mtu (0xffff)
+    m_mtu (0xffff),
+    m_oldestSlot (std::numeric_limits<uint32_t>::max ()),
+    m_newestSlot (std::numeric_limits<uint32_t>::max ()),
+    m_bufferEvictions (0),
+    m_flowGeneration (1),
+    m_flowCacheHits (0),
+    m_flowCacheMisses (0),
+    m_pendingMissQueueSize (0),
+    m_coalescedMisses (0),
+    m_packetInRate (0),
+    m_packetInBurst (100),
+    m_packetInOverflow (OVERFLOW_DROP),
+    m_packetIns (0),
+    m_packetInMeterDrops (0),
+    m_nextFlowSerial (0),
+    m_expiryTick (0)
 {
   NS_LOG_FUNCTION_NOARGS ();
 
   m_channel = CreateObject<BridgeChannel> ();
 
-  time_init (); // OFSI's clock; needed to use the buffer storage system.
+  time_init (); // OFSI's clock; flow timestamps use ofi::FlowTimeNow () instead.
   // m_lastTimeout = time_now ();
 
   m_controller = 0;
@@ -110,9 +284,16 @@ OpenFlowSwitchNetDevice::OpenFlowSwitchNetDevice ()
     {
       NS_LOG_ERROR ("Not enough memory to create the flow table.");
     }
+  else if (ofi::TupleSpaceTableInstall (m_chain) != 0)
+    {
+      NS_LOG_WARN ("Could not install the tuple-space table; wildcarded flows stay in the linear table.");
+    }
 
   m_ports.reserve (DP_MAX_PORTS);
   vport_table_init (&m_vportTable);
+
+  m_toController.SetDeliverCallback (MakeCallback (&OpenFlowSwitchNetDevice::DeliverToController, this));
+  m_fromController.SetDeliverCallback (MakeCallback (&OpenFlowSwitchNetDevice::DeliverFromController, this));
 }
 
 OpenFlowSwitchNetDevice::~OpenFlowSwitchNetDevice ()
@@ -131,9 +312,33 @@ OpenFlowSwitchNetDevice::DoDispose ()
       b->netdev = 0;
     }
   m_ports.clear ();
+  m_floodPorts.clear ();
 
   m_controller = 0;
+  m_toController.Clear ();
+  m_fromController.Clear ();
 
+  for (PacketData_t::iterator b = m_packetData.begin (), e = m_packetData.end (); b != e; b++)
+    {
+      if (b->packet_uid != std::numeric_limits<uint32_t>::max () && b->data.buffer != 0)
+        {
+          ofpbuf_delete (b->data.buffer);
+        }
+    }
+  m_lookupEvent.Cancel ();
+  m_pendingLookups.clear ();
+  for (PendingMisses_t::iterator it = m_pendingMisses.begin (); it != m_pendingMisses.end (); it++)
+    {
+      it->second.timeout.Cancel ();
+    }
+  m_pendingMisses.clear ();
+  m_packetData.clear ();
+  m_freeSlots.clear ();
+  m_flowCache.clear ();
+  m_flowStates.clear ();
+  m_vportPrograms.clear ();
+  m_expiryEvent.Cancel ();
+  m_flowTimers.Clear ();
   chain_destroy (m_chain);
   RBTreeDestroy (m_vportTable.table);
   m_channel = 0;
@@ -176,8 +381,11 @@ OpenFlowSwitchNetDevice::AddSwitchPort (Ptr<NetDevice> switchPort)
     {
       ofi::Port p;
       p.config = 0;
+      p.state = 0;
       p.netdev = switchPort;
+      UpdatePortStatus (p);
       m_ports.push_back (p);
+      UpdateFloodPorts ();
 
       // Notify the controller that this port has been added
       SendPortStatus (p, OFPPR_ADD);
@@ -186,6 +394,7 @@ OpenFlowSwitchNetDevice::AddSwitchPort (Ptr<NetDevice> switchPort)
       m_node->RegisterProtocolHandler (MakeCallback (&OpenFlowSwitchNetDevice::ReceiveFromDevice, this),
                                        0, switchPort, true);
       m_channel->AddChannel (switchPort->GetChannel ());
+      switchPort->AddLinkChangeCallback (MakeCallback (&OpenFlowSwitchNetDevice::PortLinkChanged, this));
     }
   else
     {
@@ -257,6 +466,7 @@ OpenFlowSwitchNetDevice::IsLinkUp (void) const
 void
 OpenFlowSwitchNetDevice::AddLinkChangeCallback (Callback<void> callback)
 {
+  m_linkChangeCallbacks.ConnectWithoutContext (callback);
 }
 
 bool
@@ -328,17 +538,7 @@ OpenFlowSwitchNetDevice::SendFrom (Ptr<Packet> packet, const Address& src, const
 {
   NS_LOG_FUNCTION_NOARGS ();
 
-  ofpbuf *buffer = BufferFromPacket (packet,src,dest,GetMtu (),protocolNumber);
-
-  uint32_t packet_uid = save_buffer (buffer);
-  ofi::SwitchPacketMetadata data;
-  data.packet = packet;
-  data.buffer = buffer;
-  data.protocolNumber = protocolNumber;
-  data.src = Address (src);
-  data.dst = Address (dest);
-  m_packetData.insert (std::make_pair (packet_uid, data));
-
+  uint32_t packet_uid = SaveBuffer (packet, protocolNumber, src, dest);
   RunThroughFlowTable (packet_uid, -1);
 
   return true;
@@ -439,16 +639,19 @@ OpenFlowSwitchNetDevice::AddVPort (const ofp_vport_mod *ovpm)
     {
       NS_LOG_ERROR ("could not insert port table entry for port " << vport);
     }
+  else
+    {
+      ofi::CompileVPortActions (vpe->port_acts->actions, actions_len, m_vportPrograms[vpe]);
+    }
 
   return error;
 }
 
 ofpbuf *
-OpenFlowSwitchNetDevice::BufferFromPacket (Ptr<const Packet> constPacket, Address src, Address dst, int mtu, uint16_t protocol)
+OpenFlowSwitchNetDevice::BufferFromPacket (Ptr<const Packet> packet, Address src, Address dst, uint16_t protocol)
 {
   NS_LOG_INFO ("Creating Openflow buffer from packet.");
 
-  Ptr<Packet> packet = constPacket->Copy ();
   /*
    * Allocate buffer with some headroom to add headers in forwarding
    * to the controller or adding a vlan tag, plus an extra 2 bytes to
@@ -456,148 +659,25 @@ OpenFlowSwitchNetDevice::BufferFromPacket (Ptr<const Packet> constPacket, Addres
    */
   const int headroom = 128 + 2;
   const int hard_header = VLAN_ETH_HEADER_LEN;
-  ofpbuf *buffer = ofpbuf_new (headroom + hard_header + mtu);
-  buffer->data = (char*)buffer->data + headroom + hard_header;
+  uint32_t size = packet->GetSize ();
+  ofpbuf *buffer = ofpbuf_new (headroom + hard_header + size);
+  ofpbuf_reserve (buffer, headroom + hard_header);
 
-  int l2_length = 0, l3_length = 0, l4_length = 0;
+  /*
+   * The ns-3 packet already holds its IP/ARP, TCP/UDP headers serialized in
+   * network byte order, which is what flow_extract parses. Copy the bytes in
+   * one go; only the Ethernet header, stripped by the receiving NetDevice,
+   * has to be written into the headroom in front of them.
+   */
+  packet->CopyData ((uint8_t*)ofpbuf_put_uninit (buffer, size), size);
 
-  //Parse Ethernet header
-  buffer->l2 = new eth_header;
-  eth_header* eth_h = (eth_header*)buffer->l2;
-  dst.CopyTo (eth_h->eth_dst);              // Destination Mac Address
-  src.CopyTo (eth_h->eth_src);              // Source Mac Address
-  if (protocol == ArpL3Protocol::PROT_NUMBER)
-    {
-      eth_h->eth_type = htons (ETH_TYPE_ARP);    // Ether Type
-    }
-  else if (protocol == Ipv4L3Protocol::PROT_NUMBER)
-    {
-      eth_h->eth_type = htons (ETH_TYPE_IP);    // Ether Type
-    }
-  else
+  eth_header* eth_h = (eth_header*)ofpbuf_push_uninit (buffer, ETH_HEADER_LEN);
+  FillEthHeader (eth_h, src, dst, protocol);
+  if (protocol != ArpL3Protocol::PROT_NUMBER && protocol != Ipv4L3Protocol::PROT_NUMBER)
     {
       NS_LOG_WARN ("Protocol unsupported: " << protocol);
     }
-  NS_LOG_INFO ("Parsed EthernetHeader");
-
-  l2_length = ETH_HEADER_LEN;
-
-  // We have to wrap this because PeekHeader has an assert fail if we check for an Ipv4Header that isn't there.
-  if (protocol == Ipv4L3Protocol::PROT_NUMBER)
-    {
-      Ipv4Header ip_hd;
-      if (packet->PeekHeader (ip_hd))
-        {
-          buffer->l3 = new ip_header;
-          ip_header* ip_h = (ip_header*)buffer->l3;
-          ip_h->ip_ihl_ver  = IP_IHL_VER (5, IP_VERSION);       // Version
-          ip_h->ip_tos      = ip_hd.GetTos ();                  // Type of Service/Differentiated Services
-          ip_h->ip_tot_len  = packet->GetSize ();               // Total Length
-          ip_h->ip_id       = ip_hd.GetIdentification ();       // Identification
-          ip_h->ip_frag_off = ip_hd.GetFragmentOffset ();       // Fragment Offset
-          ip_h->ip_ttl      = ip_hd.GetTtl ();                  // Time to Live
-          ip_h->ip_proto    = ip_hd.GetProtocol ();             // Protocol
-          ip_h->ip_src      = htonl (ip_hd.GetSource ().Get ()); // Source Address
-          ip_h->ip_dst      = htonl (ip_hd.GetDestination ().Get ()); // Destination Address
-          ip_h->ip_csum     = csum (&ip_h, sizeof ip_h);        // Header Checksum
-          NS_LOG_INFO ("Parsed Ipv4Header");
-          packet->RemoveHeader (ip_hd);
-
-          l3_length = IP_HEADER_LEN;
-        }
-    }
-  else
-    {
-      // ARP Packet; the underlying OpenFlow header isn't used to match, so this is probably superfluous.
-      ArpHeader arp_hd;
-      if (packet->PeekHeader (arp_hd))
-        {
-          buffer->l3 = new arp_eth_header;
-          arp_eth_header* arp_h = (arp_eth_header*)buffer->l3;
-          arp_h->ar_hrd = ARP_HRD_ETHERNET;                             // Hardware type.
-          arp_h->ar_pro = ARP_PRO_IP;                                   // Protocol type.
-          arp_h->ar_op = arp_hd.m_type;                                 // Opcode.
-          arp_hd.GetDestinationHardwareAddress ().CopyTo (arp_h->ar_tha); // Target hardware address.
-          arp_hd.GetSourceHardwareAddress ().CopyTo (arp_h->ar_sha);    // Sender hardware address.
-          arp_h->ar_tpa = arp_hd.GetDestinationIpv4Address ().Get ();   // Target protocol address.
-          arp_h->ar_spa = arp_hd.GetSourceIpv4Address ().Get ();        // Sender protocol address.
-          arp_h->ar_hln = sizeof arp_h->ar_tha;                         // Hardware address length.
-          arp_h->ar_pln = sizeof arp_h->ar_tpa;                         // Protocol address length.
-          NS_LOG_INFO ("Parsed ArpHeader");
-          packet->RemoveHeader (arp_hd);
-
-          l3_length = ARP_ETH_HEADER_LEN;
-        }
-    }
-
-  if (protocol == Ipv4L3Protocol::PROT_NUMBER)
-    {
-      ip_header* ip_h = (ip_header*)buffer->l3;
-      if (ip_h->ip_proto == TcpL4Protocol::PROT_NUMBER)
-        {
-          TcpHeader tcp_hd;
-          if (packet->PeekHeader (tcp_hd))
-            {
-              buffer->l4 = new tcp_header;
-              tcp_header* tcp_h = (tcp_header*)buffer->l4;
-              tcp_h->tcp_src = htons (tcp_hd.GetSourcePort ());         // Source Port
-              tcp_h->tcp_dst = htons (tcp_hd.GetDestinationPort ());    // Destination Port
-              tcp_h->tcp_seq = tcp_hd.GetSequenceNumber ().GetValue (); // Sequence Number
-              tcp_h->tcp_ack = tcp_hd.GetAckNumber ().GetValue ();      // ACK Number
-              tcp_h->tcp_ctl = TCP_FLAGS (tcp_hd.GetFlags ());  // Data Offset + Reserved + Flags
-              tcp_h->tcp_winsz = tcp_hd.GetWindowSize ();       // Window Size
-              tcp_h->tcp_urg = tcp_hd.GetUrgentPointer ();      // Urgent Pointer
-              tcp_h->tcp_csum = csum (&tcp_h, sizeof tcp_h);    // Header Checksum
-              NS_LOG_INFO ("Parsed TcpHeader");
-              packet->RemoveHeader (tcp_hd);
-
-              l4_length = TCP_HEADER_LEN;
-            }
-        }
-      else if (ip_h->ip_proto == UdpL4Protocol::PROT_NUMBER)
-        {
-          UdpHeader udp_hd;
-          if (packet->PeekHeader (udp_hd))
-            {
-              buffer->l4 = new udp_header;
-              udp_header* udp_h = (udp_header*)buffer->l4;
-              udp_h->udp_src = htons (udp_hd.GetSourcePort ());     // Source Port
-              udp_h->udp_dst = htons (udp_hd.GetDestinationPort ()); // Destination Port
-              udp_h->udp_len = htons (UDP_HEADER_LEN + packet->GetSize ());
-
-              ip_header* ip_h = (ip_header*)buffer->l3;
-              uint32_t udp_csum = csum_add32 (0, ip_h->ip_src);
-              udp_csum = csum_add32 (udp_csum, ip_h->ip_dst);
-              udp_csum = csum_add16 (udp_csum, IP_TYPE_UDP << 8);
-              udp_csum = csum_add16 (udp_csum, udp_h->udp_len);
-              udp_csum = csum_continue (udp_csum, udp_h, sizeof udp_h);
-              udp_h->udp_csum = csum_finish (csum_continue (udp_csum, buffer->data, buffer->size)); // Header Checksum
-              NS_LOG_INFO ("Parsed UdpHeader");
-              packet->RemoveHeader (udp_hd);
-
-              l4_length = UDP_HEADER_LEN;
-            }
-        }
-    }
-
-  // Load any remaining packet data into buffer data
-  packet->CopyData ((uint8_t*)buffer->data, packet->GetSize ());
-
-  if (buffer->l4)
-    {
-      ofpbuf_push (buffer, buffer->l4, l4_length);
-      delete (tcp_header*)buffer->l4;
-    }
-  if (buffer->l3)
-    {
-      ofpbuf_push (buffer, buffer->l3, l3_length);
-      delete (ip_header*)buffer->l3;
-    }
-  if (buffer->l2)
-    {
-      ofpbuf_push (buffer, buffer->l2, l2_length);
-      delete (eth_header*)buffer->l2;
-    }
+  buffer->l2 = eth_h;
 
   return buffer;
 }
@@ -639,19 +719,11 @@ OpenFlowSwitchNetDevice::ReceiveFromDevice (Ptr<NetDevice> netdev, Ptr<const Pac
                       m_rxCallback (this, packet, protocol, src);
                     }
 
-                  ofi::SwitchPacketMetadata data;
-                  data.packet = packet->Copy ();
-
-                  ofpbuf *buffer = BufferFromPacket (data.packet,src,dst,netdev->GetMtu (),protocol);
+                  // The OpenFlow buffer is only built if the controller or a rewriting action needs it.
+                  Ptr<Packet> copy = packet->Copy ();
                   m_ports[i].rx_packets++;
-                  m_ports[i].rx_bytes += buffer->size;
-                  data.buffer = buffer;
-                  uint32_t packet_uid = save_buffer (buffer);
-
-                  data.protocolNumber = protocol;
-                  data.src = Address (src);
-                  data.dst = Address (dst);
-                  m_packetData.insert (std::make_pair (packet_uid, data));
+                  m_ports[i].rx_bytes += ETH_HEADER_LEN + copy->GetSize ();
+                  uint32_t packet_uid = SaveBuffer (copy, protocol, src, dst);
 
                   RunThroughFlowTable (packet_uid, i);
                 }
@@ -660,43 +732,6 @@ OpenFlowSwitchNetDevice::ReceiveFromDevice (Ptr<NetDevice> netdev, Ptr<const Pac
           break;
         }
     }
-
-  // Run periodic execution.
-  Time now = Simulator::Now ();
-  if (now >= Seconds (m_lastExecute.GetSeconds () + 1)) // If a second or more has passed from the simulation time, execute.
-    {
-      // If port status is modified in any way, notify the controller.
-      for (size_t i = 0; i < m_ports.size (); i++)
-        {
-          if (UpdatePortStatus (m_ports[i]))
-            {
-              SendPortStatus (m_ports[i], OFPPR_MODIFY);
-            }
-        }
-
-      // If any flows have expired, delete them and notify the controller.
-      List deleted = LIST_INITIALIZER (&deleted);
-      sw_flow *f, *n;
-      chain_timeout (m_chain, &deleted);
-      LIST_FOR_EACH_SAFE (f, n, sw_flow, node, &deleted)
-      {
-        std::ostringstream str;
-        str << "Flow [";
-        for (int i = 0; i < 6; i++)
-          str << (i!=0 ? ":" : "") << std::hex << f->key.flow.dl_src[i]/16 << f->key.flow.dl_src[i]%16;
-        str << " -> ";
-        for (int i = 0; i < 6; i++)
-          str << (i!=0 ? ":" : "") << std::hex << f->key.flow.dl_dst[i]/16 << f->key.flow.dl_dst[i]%16;
-        str <<  "] expired.";
-	
-        NS_LOG_INFO (str.str ());
-        SendFlowExpired (f, (ofp_flow_expired_reason)f->reason);
-        list_remove (&f->node);
-        flow_free (f);
-      }
-
-      m_lastExecute = now;
-    }
 }
 
 int
@@ -705,26 +740,27 @@ OpenFlowSwitchNetDevice::OutputAll (uint32_t packet_uid, int in_port, bool flood
   NS_LOG_FUNCTION_NOARGS ();
   NS_LOG_INFO ("Flooding over ports.");
 
-  int prev_port = -1;
-  for (size_t i = 0; i < m_ports.size (); i++)
+  // One metadata lookup for the whole flood.
+  const ofi::SwitchPacketMetadata& data = GetPacketData (packet_uid);
+  if (flood)
     {
-      if (i == (unsigned)in_port) // Originating port
-        {
-          continue;
-        }
-      if (flood && m_ports[i].config & OFPPC_NO_FLOOD) // Port configured to not allow flooding
-        {
-          continue;
-        }
-      if (prev_port != -1)
+      for (size_t i = 0; i < m_floodPorts.size (); i++)
         {
-          OutputPort (packet_uid, in_port, prev_port, false);
+          if (m_floodPorts[i] != (unsigned)in_port) // Originating port
+            {
+              OutputPacket (data, m_floodPorts[i]);
+            }
         }
-      prev_port = i;
     }
-  if (prev_port != -1)
+  else
     {
-      OutputPort (packet_uid, in_port, prev_port, false);
+      for (size_t i = 0; i < m_ports.size (); i++)
+        {
+          if (i != (unsigned)in_port) // Originating port
+            {
+              OutputPacket (data, i);
+            }
+        }
     }
 
   return 0;
@@ -735,28 +771,50 @@ OpenFlowSwitchNetDevice::OutputPacket (uint32_t packet_uid, int out_port)
 {
   if (out_port >= 0 && out_port < DP_MAX_PORTS)
     {
-      ofi::Port& p = m_ports[out_port];
-      if (p.netdev != 0 && !(p.config & OFPPC_PORT_DOWN))
-        {
-          ofi::SwitchPacketMetadata data = m_packetData.find (packet_uid)->second;
-          size_t bufsize = data.buffer->size;
-          NS_LOG_INFO ("Sending packet " << data.packet->GetUid () << " over port " << out_port);
-          if (p.netdev->SendFrom (data.packet->Copy (), data.src, data.dst, data.protocolNumber))
-            {
-              p.tx_packets++;
-              p.tx_bytes += bufsize;
-            }
-          else
-            {
-              p.tx_dropped++;
-            }
-          return;
-        }
+      OutputPacket (GetPacketData (packet_uid), out_port);
+      return;
     }
 
   NS_LOG_DEBUG ("can't forward to bad port " << out_port);
 }
 
+void
+OpenFlowSwitchNetDevice::OutputPacket (const ofi::SwitchPacketMetadata& data, int out_port)
+{
+  ofi::Port& p = m_ports[out_port];
+  if (p.netdev == 0 || (p.config & OFPPC_PORT_DOWN))
+    {
+      NS_LOG_DEBUG ("can't forward to bad port " << out_port);
+      return;
+    }
+
+  // The port's NetDevice adds its own headers, so it needs a copy; copies share the packet's bytes.
+  NS_LOG_INFO ("Sending packet " << data.packet->GetUid () << " over port " << out_port);
+  if (p.netdev->SendFrom (data.packet->Copy (), data.src, data.dst, data.protocolNumber))
+    {
+      p.tx_packets++;
+      p.tx_bytes += FrameSize (data);
+    }
+  else
+    {
+      p.tx_dropped++;
+    }
+}
+
+void
+OpenFlowSwitchNetDevice::UpdateFloodPorts (void)
+{
+  m_floodPorts.clear ();
+  for (size_t i = 0; i < m_ports.size (); i++)
+    {
+      // Skip ports configured to not allow flooding, and ports whose link is down.
+      if (!(m_ports[i].config & OFPPC_NO_FLOOD) && !(m_ports[i].state & OFPPS_LINK_DOWN))
+        {
+          m_floodPorts.push_back (i);
+        }
+    }
+}
+
 void
 OpenFlowSwitchNetDevice::OutputPort (uint32_t packet_uid, int in_port, int out_port, bool ignore_no_fwd)
 {
@@ -817,35 +875,109 @@ OpenFlowSwitchNetDevice::SendOpenflowBuffer (ofpbuf *buffer)
   if (m_controller != 0)
     {
       update_openflow_length (buffer);
-      m_controller->ReceiveFromSwitch (this, buffer);
+      if (m_toController.IsInstant ())
+        {
+          m_controller->EnqueueFromSwitch (this, buffer);
+        }
+      else if (!m_toController.Send (buffer->data, buffer->size))
+        {
+          return -ENOBUFS;
+        }
     }
 
   return 0;
 }
 
 void
+OpenFlowSwitchNetDevice::DeliverToController (const uint8_t *msg, size_t length)
+{
+  if (m_controller != 0)
+    {
+      ofpbuf *buffer = ofpbuf_new (length);
+      ofpbuf_put (buffer, msg, length);
+      m_controller->EnqueueFromSwitch (this, buffer);
+      ofpbuf_delete (buffer);
+    }
+}
+
+void
+OpenFlowSwitchNetDevice::DeliverFromController (const uint8_t *msg, size_t length)
+{
+  ProcessControlInput (msg, length);
+}
+
+bool
 OpenFlowSwitchNetDevice::OutputControl (uint32_t packet_uid, int in_port, size_t max_len, int reason)
 {
+  if (!m_packetInMeter.Take (m_packetInRate, m_packetInBurst))
+    {
+      NS_LOG_DEBUG ("Packet in over the meter rate; not sending packet " << packet_uid << " to the controller");
+      m_packetInMeterDrops++;
+      return false;
+    }
   NS_LOG_INFO ("Sending packet to controller");
 
-  ofpbuf* buffer = m_packetData.find (packet_uid)->second.buffer;
-  size_t total_len = buffer->size;
-  if (packet_uid != std::numeric_limits<uint32_t>::max () && max_len != 0 && buffer->size > max_len)
+  // The packet-in is built in its own buffer; the buffered packet stays intact for the controller to refer to.
+  const ofi::SwitchPacketMetadata& data = GetPacketData (packet_uid);
+  size_t total_len = FrameSize (data);
+  size_t data_len = total_len;
+  if (packet_uid != std::numeric_limits<uint32_t>::max () && max_len != 0 && data_len > max_len)
     {
-      buffer->size = max_len;
+      data_len = max_len;
     }
 
-  ofp_packet_in *opi = (ofp_packet_in*)ofpbuf_push_uninit (buffer, offsetof (ofp_packet_in, data));
+  ofpbuf *msg = ofpbuf_new (offsetof (ofp_packet_in, data) + data_len);
+  ofp_packet_in *opi = (ofp_packet_in*)ofpbuf_put_uninit (msg, offsetof (ofp_packet_in, data));
   opi->header.version = OFP_VERSION;
   opi->header.type    = OFPT_PACKET_IN;
-  opi->header.length  = htons (buffer->size);
+  opi->header.length  = htons (offsetof (ofp_packet_in, data) + data_len);
   opi->header.xid     = htonl (0);
   opi->buffer_id      = htonl (packet_uid);
   opi->total_len      = htons (total_len);
   opi->in_port        = htons (in_port);
   opi->reason         = reason;
   opi->pad            = 0;
-  SendOpenflowBuffer (buffer);
+  if (data.buffer != 0)
+    {
+      ofpbuf_put (msg, data.buffer->data, data_len);
+    }
+  else
+    {
+      // Copy no more than the controller gets; the rest stays in the Packet until the buffer is released.
+      uint8_t *p = (uint8_t*)ofpbuf_put_uninit (msg, data_len);
+      eth_header eth_h;
+      FillEthHeader (&eth_h, data.src, data.dst, data.protocolNumber);
+      size_t eth_len = std::min (data_len, (size_t)ETH_HEADER_LEN);
+      memcpy (p, &eth_h, eth_len);
+      data.packet->CopyData (p + eth_len, data_len - eth_len);
+    }
+  SendOpenflowBuffer (msg);
+  ofpbuf_delete (msg);
+  m_packetIns++;
+  return true;
+}
+
+void
+OpenFlowSwitchNetDevice::SendMissToController (const sw_flow_key& key, uint32_t packet_uid, int in_port)
+{
+  if (OutputControl (packet_uid, in_port, m_missSendLen, OFPR_NO_MATCH))
+    {
+      return;
+    }
+
+  // The controller won't hear of the flow; don't hold its next packets back for it.
+  PendingMisses_t::iterator it = m_pendingMisses.find (key.flow);
+  if (it != m_pendingMisses.end () && it->second.packets.empty ())
+    {
+      it->second.timeout.Cancel ();
+      m_pendingMisses.erase (it);
+    }
+
+  if (m_packetInOverflow == OVERFLOW_FLOOD)
+    {
+      OutputAll (packet_uid, in_port, true);
+    }
+  DiscardBuffer (packet_uid);
 }
 
 void
@@ -875,7 +1007,7 @@ OpenFlowSwitchNetDevice::SendFeaturesReply ()
   ofp_switch_features *ofr = (ofp_switch_features*)MakeOpenflowReply (sizeof *ofr, OFPT_FEATURES_REPLY, &buffer);
   ofr->datapath_id  = htonll (m_id);
   ofr->n_tables     = m_chain->n_tables;
-  ofr->n_buffers    = htonl (N_PKT_BUFFERS);
+  ofr->n_buffers    = htonl (GetNBuffers ());
   ofr->capabilities = htonl (OFP_SUPPORTED_CAPABILITIES);
   ofr->actions      = htonl (OFP_SUPPORTED_ACTIONS);
 
@@ -921,6 +1053,35 @@ OpenFlowSwitchNetDevice::UpdatePortStatus (ofi::Port& p)
   return ((orig_config != p.config) || (orig_state != p.state));
 }
 
+void
+OpenFlowSwitchNetDevice::PortLinkChanged (void)
+{
+  NS_LOG_FUNCTION_NOARGS ();
+
+  // A device doesn't say which of its links changed, so check every port.
+  std::vector<size_t> changed;
+  for (size_t i = 0; i < m_ports.size (); i++)
+    {
+      if (UpdatePortStatus (m_ports[i]))
+        {
+          NS_LOG_INFO ("Link of port " << i << (m_ports[i].state & OFPPS_LINK_DOWN ? " went down." : " came up."));
+          changed.push_back (i);
+        }
+    }
+  if (changed.empty ())
+    {
+      return;
+    }
+
+  // Floods stop using a dead link before the controller hears of it.
+  UpdateFloodPorts ();
+  for (size_t i = 0; i < changed.size (); i++)
+    {
+      SendPortStatus (m_ports[changed[i]], OFPPR_MODIFY);
+    }
+  m_linkChangeCallbacks ();
+}
+
 void
 OpenFlowSwitchNetDevice::SendPortStatus (ofi::Port p, uint8_t status)
 {
@@ -945,7 +1106,7 @@ OpenFlowSwitchNetDevice::SendFlowExpired (sw_flow *flow, enum ofp_flow_expired_r
   ofe->reason = reason;
   memset (ofe->pad, 0, sizeof ofe->pad);
 
-  ofe->duration     = htonl (time_now () - flow->created);
+  ofe->duration     = htonl (ofi::FlowTimeNow () - flow->created);
   memset (ofe->pad2, 0, sizeof ofe->pad2);
   ofe->packet_count = htonll (flow->packet_count);
   ofe->byte_count   = htonll (flow->byte_count);
@@ -963,59 +1124,736 @@ OpenFlowSwitchNetDevice::SendErrorMsg (uint16_t type, uint16_t code, const void
   SendOpenflowBuffer (buffer);
 }
 
-void
-OpenFlowSwitchNetDevice::FlowTableLookup (sw_flow_key key, ofpbuf* buffer, uint32_t packet_uid, int port, bool send_to_controller)
-{
-  sw_flow *flow = chain_lookup (m_chain, &key);
-  if (flow != 0)
+uint32_t
+OpenFlowSwitchNetDevice::SaveBuffer (Ptr<Packet> packet, uint16_t protocol, const Address& src, const Address& dst)
+{
+  const uint32_t none = std::numeric_limits<uint32_t>::max ();
+  if (m_packetData.empty ())
+    {
+      // Sized on first use, once the BufferSlotBits attribute is set.
+      PacketSlot freeSlot;
+      freeSlot.packet_uid = none;
+      freeSlot.cookie = 0;
+      freeSlot.users = 0;
+      freeSlot.older = none;
+      freeSlot.newer = none;
+      freeSlot.data.buffer = 0;
+      freeSlot.data.protocolNumber = 0;
+      m_packetData.assign (1u << m_bufferSlotBits, freeSlot);
+      m_freeSlots.reserve (m_packetData.size ());
+      for (uint32_t i = m_packetData.size (); i > 0; i--)
+        {
+          m_freeSlots.push_back (i - 1);
+        }
+    }
+
+  if (m_freeSlots.empty ())
     {
-      NS_LOG_INFO ("Flow matched");
-      flow_used (flow, buffer);
-      ofi::ExecuteActions (this, packet_uid, buffer, &key, flow->sf_acts->actions, flow->sf_acts->actions_len, false);
+      uint32_t victim = m_packetData[m_oldestSlot].packet_uid;
+      NS_LOG_WARN ("Packet buffers full; dropping buffered packet " << victim);
+      m_packetData[m_oldestSlot].users = 1; // Dropped however many still hold it; they find it gone.
+      DiscardBuffer (victim);
+      m_bufferEvictions++;
     }
-  else
+
+  uint32_t index = m_freeSlots.back ();
+  m_freeSlots.pop_back ();
+  PacketSlot& slot = m_packetData[index];
+
+  // Don't use the maximum cookie value, since the all-bits-1 id means "not buffered".
+  if (++slot.cookie >= (1u << (32 - m_bufferSlotBits)) - 1)
     {
-      NS_LOG_INFO ("Flow not matched.");
+      slot.cookie = 0;
+    }
+  slot.packet_uid = index | (slot.cookie << m_bufferSlotBits);
+  slot.users = 1;
+  slot.data.packet = packet;
+  slot.data.buffer = 0;
+  slot.data.protocolNumber = protocol;
+  slot.data.src = src;
+  slot.data.dst = dst;
 
-      if (send_to_controller)
-        {
-          OutputControl (packet_uid, port, m_missSendLen, OFPR_NO_MATCH);
-        }
+  slot.older = m_newestSlot;
+  slot.newer = none;
+  if (m_newestSlot != none)
+    {
+      m_packetData[m_newestSlot].newer = index;
+    }
+  else
+    {
+      m_oldestSlot = index;
     }
+  m_newestSlot = index;
 
-  // Clean up; at this point we're done with the packet.
-  m_packetData.erase (packet_uid);
-  discard_buffer (packet_uid);
-  ofpbuf_delete (buffer);
+  return slot.packet_uid;
 }
 
-void
-OpenFlowSwitchNetDevice::RunThroughFlowTable (uint32_t packet_uid, int port, bool send_to_controller)
+bool
+OpenFlowSwitchNetDevice::IsBuffered (uint32_t packet_uid) const
 {
-  ofi::SwitchPacketMetadata data = m_packetData.find (packet_uid)->second;
-  ofpbuf* buffer = data.buffer;
+  if (packet_uid == std::numeric_limits<uint32_t>::max () || m_packetData.empty ())
+    {
+      return false;
+    }
 
-  sw_flow_key key;
-  key.wildcards = 0; // Lookup cannot take wildcards.
-  // Extract the matching key's flow data from the packet's headers; if the policy is to drop fragments and the message is a fragment, drop it.
-  if (flow_extract (buffer, port != -1 ? port : OFPP_NONE, &key.flow) && (m_flags & OFPC_FRAG_MASK) == OFPC_FRAG_DROP)
+  return m_packetData[packet_uid & (m_packetData.size () - 1)].packet_uid == packet_uid;
+}
+
+ofpbuf*
+OpenFlowSwitchNetDevice::RetrieveBuffer (uint32_t packet_uid)
+{
+  if (!IsBuffered (packet_uid))
     {
-      ofpbuf_delete (buffer);
-      return;
+      return 0;
     }
 
-  // drop MPLS packets with TTL 1
-  if (buffer->l2_5)
+  ofi::SwitchPacketMetadata& data = m_packetData[packet_uid & (m_packetData.size () - 1)].data;
+  if (data.buffer == 0)
     {
-      mpls_header mpls_h;
-      mpls_h.value = ntohl (*((uint32_t*)buffer->l2_5));
-      if (mpls_h.ttl == 1)
-        {
-          // increment mpls drop counter
+      data.buffer = BufferFromPacket (data.packet, data.src, data.dst, data.protocolNumber);
+    }
+  return data.buffer;
+}
+
+ofi::SwitchPacketMetadata&
+OpenFlowSwitchNetDevice::GetPacketData (uint32_t packet_uid)
+{
+  NS_ASSERT_MSG (IsBuffered (packet_uid), "No packet buffered under " << packet_uid);
+  return m_packetData[packet_uid & (m_packetData.size () - 1)].data;
+}
+
+void
+OpenFlowSwitchNetDevice::DiscardBuffer (uint32_t packet_uid)
+{
+  const uint32_t none = std::numeric_limits<uint32_t>::max ();
+  if (!IsBuffered (packet_uid))
+    {
+      return;
+    }
+
+  uint32_t index = packet_uid & (m_packetData.size () - 1);
+  PacketSlot& slot = m_packetData[index];
+  if (--slot.users > 0)
+    {
+      return;
+    }
+  if (slot.data.buffer != 0)
+    {
+      ofpbuf_delete (slot.data.buffer);
+    }
+  slot.data.buffer = 0;
+  slot.data.packet = 0;
+  slot.packet_uid = none;
+
+  if (slot.older != none)
+    {
+      m_packetData[slot.older].newer = slot.newer;
+    }
+  else
+    {
+      m_oldestSlot = slot.newer;
+    }
+  if (slot.newer != none)
+    {
+      m_packetData[slot.newer].older = slot.older;
+    }
+  else
+    {
+      m_newestSlot = slot.older;
+    }
+  slot.older = none;
+  slot.newer = none;
+  m_freeSlots.push_back (index);
+}
+
+uint32_t
+OpenFlowSwitchNetDevice::GetNBuffers (void) const
+{
+  return m_packetData.empty () ? 1u << m_bufferSlotBits : m_packetData.size ();
+}
+
+uint64_t
+OpenFlowSwitchNetDevice::GetBufferEvictions (void) const
+{
+  return m_bufferEvictions;
+}
+
+uint64_t
+OpenFlowSwitchNetDevice::GetControlMessages (void) const
+{
+  return m_toController.GetDelivered () + m_fromController.GetDelivered ();
+}
+
+uint64_t
+OpenFlowSwitchNetDevice::GetControlDrops (void) const
+{
+  return m_toController.GetDrops () + m_fromController.GetDrops ();
+}
+
+Time
+OpenFlowSwitchNetDevice::GetControlQueueingDelay (void) const
+{
+  return m_toController.GetQueueingDelay () + m_fromController.GetQueueingDelay ();
+}
+
+void
+OpenFlowSwitchNetDevice::SetControlDelay (Time delay)
+{
+  m_toController.SetDelay (delay);
+  m_fromController.SetDelay (delay);
+}
+
+Time
+OpenFlowSwitchNetDevice::GetControlDelay (void) const
+{
+  return m_toController.GetDelay ();
+}
+
+void
+OpenFlowSwitchNetDevice::SetControlDataRate (DataRate rate)
+{
+  m_toController.SetDataRate (rate);
+  m_fromController.SetDataRate (rate);
+}
+
+DataRate
+OpenFlowSwitchNetDevice::GetControlDataRate (void) const
+{
+  return m_toController.GetDataRate ();
+}
+
+void
+OpenFlowSwitchNetDevice::SetControlQueueSize (uint32_t size)
+{
+  m_toController.SetMaxMessages (size);
+  m_fromController.SetMaxMessages (size);
+}
+
+uint32_t
+OpenFlowSwitchNetDevice::GetControlQueueSize (void) const
+{
+  return m_toController.GetMaxMessages ();
+}
+
+sw_flow*
+OpenFlowSwitchNetDevice::LookupFlowCached (const sw_flow_key *key, const ofi::ActionProgram **program)
+{
+  if (m_flowCacheSize == 0)
+    {
+      sw_flow *flow = chain_lookup (m_chain, key);
+      if (flow != 0)
+        {
+          *program = &m_flowStates[flow].program;
+        }
+      return flow;
+    }
+  if (m_flowCache.size () != m_flowCacheSize)
+    {
+      m_flowCache.assign (m_flowCacheSize, FlowCacheEntry ());
+    }
+
+  FlowCacheEntry& entry = m_flowCache[HashFlowKey (&key->flow) % m_flowCacheSize];
+  if (entry.generation == m_flowGeneration && memcmp (&entry.key, &key->flow, sizeof entry.key) == 0)
+    {
+      // Count the lookups the chain walk would have made, so table stats don't depend on the cache.
+      m_flowCacheHits++;
+      for (int i = 0; i <= entry.table; i++)
+        {
+          m_chain->tables[i]->n_lookup++;
+        }
+      m_chain->tables[entry.table]->n_matched++;
+      *program = entry.program;
+      return entry.flow;
+    }
+
+  // Walk the chain as chain_lookup does, keeping the table that matched.
+  m_flowCacheMisses++;
+  sw_flow *flow = 0;
+  int i;
+  for (i = 0; i < m_chain->n_tables && flow == 0; i++)
+    {
+      sw_table *table = m_chain->tables[i];
+      flow = table->lookup (table, key);
+      table->n_lookup++;
+    }
+  if (flow != 0)
+    {
+      m_chain->tables[i - 1]->n_matched++;
+      entry.generation = m_flowGeneration;
+      entry.key = key->flow;
+      entry.flow = flow;
+      entry.table = i - 1;
+      entry.program = &m_flowStates[flow].program;
+      *program = entry.program;
+    }
+  return flow;
+}
+
+void
+OpenFlowSwitchNetDevice::InvalidateFlowCache (void)
+{
+  // Entries are only trusted under the generation they were stored with.
+  if (++m_flowGeneration == 0)
+    {
+      m_flowGeneration = 1;
+      m_flowCache.assign (m_flowCache.size (), FlowCacheEntry ());
+    }
+}
+
+void
+OpenFlowSwitchNetDevice::ArmFlowTimer (sw_flow *flow)
+{
+  if (flow->idle_timeout == OFP_FLOW_PERMANENT && flow->hard_timeout == OFP_FLOW_PERMANENT)
+    {
+      return;
+    }
+
+  if (m_flowTimers.GetSize () == 0)
+    {
+      std::vector<ofi::FlowTimerWheel::Timer> none;
+      m_flowTimers.Advance (ofi::FlowTimeNow (), none);
+    }
+
+  uint64_t serial = ++m_nextFlowSerial;
+  m_flowStates[flow].serial = serial;
+  m_flowTimers.Schedule (FlowDeadline (flow), flow, serial);
+  ScheduleFlowExpiry ();
+}
+
+void
+OpenFlowSwitchNetDevice::ScheduleFlowExpiry (void)
+{
+  uint64_t next = m_flowTimers.GetNextTick ();
+  if (next == 0 || (m_expiryEvent.IsRunning () && m_expiryTick <= next))
+    {
+      return;
+    }
+
+  m_expiryEvent.Cancel ();
+  m_expiryTick = next;
+  Time delay = Seconds (next) - Simulator::Now ();
+  m_expiryEvent = Simulator::Schedule (delay.IsPositive () ? delay : Seconds (0), &OpenFlowSwitchNetDevice::ExpireFlows, this);
+}
+
+void
+OpenFlowSwitchNetDevice::ExpireFlows (void)
+{
+  uint64_t now = ofi::FlowTimeNow ();
+  std::vector<ofi::FlowTimerWheel::Timer> due;
+  m_flowTimers.Advance (now, due);
+
+  bool expired = false;
+  for (std::vector<ofi::FlowTimerWheel::Timer>::const_iterator t = due.begin (); t != due.end (); t++)
+    {
+      FlowStates_t::iterator s = m_flowStates.find (t->flow);
+      if (s == m_flowStates.end () || s->second.serial != t->serial)
+        {
+          continue; // The flow is gone, or another flow took its place.
+        }
+
+      sw_flow *f = t->flow;
+      uint64_t deadline = FlowDeadline (f);
+      if (deadline > now)
+        {
+          // Used since the timer was armed.
+          m_flowTimers.Schedule (deadline, f, t->serial);
+          continue;
+        }
+
+      std::ostringstream str;
+      str << "Flow [";
+      for (int i = 0; i < 6; i++)
+        str << (i!=0 ? ":" : "") << std::hex << f->key.flow.dl_src[i]/16 << f->key.flow.dl_src[i]%16;
+      str << " -> ";
+      for (int i = 0; i < 6; i++)
+        str << (i!=0 ? ":" : "") << std::hex << f->key.flow.dl_dst[i]/16 << f->key.flow.dl_dst[i]%16;
+      str <<  "] expired.";
+      NS_LOG_INFO (str.str ());
+
+      bool hard = f->hard_timeout != OFP_FLOW_PERMANENT && now >= f->created + f->hard_timeout;
+      SendFlowExpired (f, hard ? OFPER_HARD_TIMEOUT : OFPER_IDLE_TIMEOUT);
+      expired = true;
+
+      // A controller answering at once may have deleted the flow already, and
+      // even added another at its address; only its own timer proves it's still there.
+      s = m_flowStates.find (t->flow);
+      if (s != m_flowStates.end () && s->second.serial == t->serial)
+        {
+          RemoveFlow (f);
+        }
+    }
+
+  if (expired)
+    {
+      InvalidateFlowCache ();
+    }
+  ScheduleFlowExpiry ();
+}
+
+sw_flow*
+OpenFlowSwitchNetDevice::FindFlow (const sw_flow_key *key, uint16_t priority)
+{
+  for (int i = 0; i < m_chain->n_tables; i++)
+    {
+      sw_table *table = m_chain->tables[i];
+      sw_table_stats stats;
+      table->stats (table, &stats);
+      sw_flow *flow = 0;
+      if (strcmp (stats.name, "tuple-space") == 0)
+        {
+          flow = ofi::TupleSpaceTableFind (table, key, priority);
+        }
+      else if (stats.wildcards == 0)
+        {
+          // Exact-match tables: the lookup finds nothing but a flow with this very key.
+          if (key->wildcards == 0)
+            {
+              flow = table->lookup (table, key);
+            }
+        }
+      else
+        {
+          StrictMatch match;
+          match.key = key;
+          match.priority = priority;
+          match.flow = 0;
+          sw_table_position position;
+          memset (&position, 0, sizeof position);
+          table->iterate (table, key, htons (OFPP_NONE), &position, FindStrictMatch, &match);
+          flow = match.flow;
+        }
+      if (flow != 0 && flow->priority == priority)
+        {
+          return flow;
+        }
+    }
+  return 0;
+}
+
+void
+OpenFlowSwitchNetDevice::RemoveFlow (sw_flow *flow)
+{
+  sw_flow_key key = flow->key; // Freed by the delete.
+  uint16_t priority = flow->priority;
+  m_flowStates.erase (flow);
+
+  // AddFlow keeps matches and priorities unique across the chain, so the strict
+  // delete removes this flow alone. Tables that can't hold its wildcards aren't
+  // made to scan for it.
+  for (int i = 0; i < m_chain->n_tables; i++)
+    {
+      sw_table *table = m_chain->tables[i];
+      sw_table_stats stats;
+      table->stats (table, &stats);
+      if ((key.wildcards & ~stats.wildcards) == 0 && table->_delete (table, &key, htons (OFPP_NONE), priority, 1))
+        {
+          return;
+        }
+    }
+}
+
+int
+OpenFlowSwitchNetDevice::DeleteFlows (const sw_flow_key *key, uint16_t out_port, uint16_t priority, int strict)
+{
+  if (strict)
+    {
+      sw_flow *flow = FindFlow (key, priority);
+      if (flow == 0 || !flow_has_out_port (flow, out_port))
+        {
+          return 0;
+        }
+      RemoveFlow (flow);
+      return 1;
+    }
+
+  // Collect the flows first; the tables can't be changed while they are iterated.
+  LooseMatch match;
+  match.key = key;
+  match.out_port = out_port;
+  for (int i = 0; i < m_chain->n_tables; i++)
+    {
+      sw_table *table = m_chain->tables[i];
+      sw_table_position position;
+      memset (&position, 0, sizeof position);
+      table->iterate (table, key, out_port, &position, CollectLooseMatch, &match);
+    }
+  for (std::vector<sw_flow*>::const_iterator f = match.flows.begin (); f != match.flows.end (); f++)
+    {
+      RemoveFlow (*f);
+    }
+  return match.flows.size ();
+}
+
+int
+OpenFlowSwitchNetDevice::ModifyFlows (const sw_flow_key *key, uint16_t priority, int strict, const ofp_action_header *actions, size_t actions_len)
+{
+  std::vector<sw_flow*> flows;
+  if (strict)
+    {
+      sw_flow *flow = FindFlow (key, priority);
+      if (flow != 0)
+        {
+          flows.push_back (flow);
+        }
+    }
+  else
+    {
+      LooseMatch match;
+      match.key = key;
+      match.out_port = OFPP_NONE;
+      for (int i = 0; i < m_chain->n_tables; i++)
+        {
+          sw_table *table = m_chain->tables[i];
+          sw_table_position position;
+          memset (&position, 0, sizeof position);
+          table->iterate (table, key, OFPP_NONE, &position, CollectLooseMatch, &match);
+        }
+      flows.swap (match.flows);
+    }
+
+  for (std::vector<sw_flow*>::const_iterator f = flows.begin (); f != flows.end (); f++)
+    {
+      flow_replace_acts (*f, actions, actions_len);
+      ofi::CompileActions ((*f)->sf_acts->actions, actions_len, m_flowStates[*f].program);
+    }
+  return flows.size ();
+}
+
+const ofi::ActionProgram&
+OpenFlowSwitchNetDevice::GetVPortProgram (const vport_table_entry *vpe)
+{
+  return m_vportPrograms.find (vpe)->second;
+}
+
+uint64_t
+OpenFlowSwitchNetDevice::GetFlowCacheHits (void) const
+{
+  return m_flowCacheHits;
+}
+
+uint64_t
+OpenFlowSwitchNetDevice::GetFlowCacheMisses (void) const
+{
+  return m_flowCacheMisses;
+}
+
+ofpbuf*
+OpenFlowSwitchNetDevice::PeekHeaders (uint32_t packet_uid, HeaderFrame& frame)
+{
+  const ofi::SwitchPacketMetadata& data = GetPacketData (packet_uid);
+  if (data.buffer != 0)
+    {
+      // Already built, and possibly rewritten by actions since.
+      return data.buffer;
+    }
+
+  ofpbuf_use (&frame.buffer, frame.data, sizeof frame.data);
+  FillEthHeader ((eth_header*)ofpbuf_put_uninit (&frame.buffer, ETH_HEADER_LEN), data.src, data.dst, data.protocolNumber);
+  frame.buffer.size += data.packet->CopyData (frame.data + ETH_HEADER_LEN, sizeof frame.data - ETH_HEADER_LEN);
+  return &frame.buffer;
+}
+
+void
+OpenFlowSwitchNetDevice::FlowTableLookup (sw_flow_key key, uint32_t packet_uid, int port, bool send_to_controller)
+{
+  if (!IsBuffered (packet_uid))
+    {
+      NS_LOG_DEBUG ("Packet " << packet_uid << " was evicted before the lookup.");
+      return;
+    }
+
+  const ofi::ActionProgram *program;
+  sw_flow *flow = LookupFlowCached (&key, &program);
+  if (flow != 0)
+    {
+      NS_LOG_INFO ("Flow matched");
+      const ofi::SwitchPacketMetadata& data = GetPacketData (packet_uid);
+      ofpbuf frame; // flow_used only counts the bytes of the frame.
+      ofpbuf_use (&frame, 0, 0);
+      frame.size = FrameSize (data);
+      flow_used (flow, &frame);
+      flow->used = ofi::FlowTimeNow (); // The idle timer picks this up when it fires.
+
+      // Output alone only needs the Packet; build the OpenFlow buffer if the actions may rewrite it.
+      ofpbuf* buffer = program->rewrites ? RetrieveBuffer (packet_uid) : data.buffer;
+      ofi::ExecuteActions (this, packet_uid, buffer, &key, *program, false);
+    }
+  else
+    {
+      NS_LOG_INFO ("Flow not matched.");
+
+      if (send_to_controller)
+        {
+          // Keep the packet buffered until the controller refers to it or it gets evicted.
+          if (!HoldMiss (key, packet_uid, port))
+            {
+              SendMissToController (key, packet_uid, port);
+            }
+          return;
+        }
+    }
+
+  // Clean up; at this point we're done with the packet.
+  DiscardBuffer (packet_uid);
+}
+
+bool
+OpenFlowSwitchNetDevice::HoldMiss (const sw_flow_key& key, uint32_t packet_uid, int port)
+{
+  if (m_pendingMissQueueSize == 0)
+    {
+      return false;
+    }
+
+  PendingMisses_t::iterator it = m_pendingMisses.find (key.flow);
+  if (it == m_pendingMisses.end ())
+    {
+      // Registered before the packet in goes out, since the controller may answer right away.
+      PendingMiss& miss = m_pendingMisses[key.flow];
+      miss.port = port;
+      miss.timeout = Simulator::Schedule (m_pendingMissTimeout, &OpenFlowSwitchNetDevice::ExpirePendingMiss, this, key.flow);
+      return false;
+    }
+  if (it->second.packets.size () >= m_pendingMissQueueSize)
+    {
+      return false;
+    }
+
+  NS_LOG_DEBUG ("Holding packet " << packet_uid << " back; its flow is already with the controller.");
+  it->second.packets.push_back (packet_uid);
+  m_coalescedMisses++;
+  return true;
+}
+
+void
+OpenFlowSwitchNetDevice::ReleasePendingMisses (const sw_flow_key *match)
+{
+  // Take the flows off the table first; their packets may miss again.
+  std::vector<std::pair< ::flow, PendingMiss> > released;
+  for (PendingMisses_t::iterator it = m_pendingMisses.begin (); it != m_pendingMisses.end (); )
+    {
+      sw_flow_key key;
+      key.flow = it->first;
+      key.wildcards = 0;
+      if (flow_matches_1wild (&key, match))
+        {
+          it->second.timeout.Cancel ();
+          released.push_back (*it);
+          it = m_pendingMisses.erase (it);
+        }
+      else
+        {
+          it++;
+        }
+    }
+
+  for (size_t i = 0; i < released.size (); i++)
+    {
+      sw_flow_key key;
+      key.flow = released[i].first;
+      key.wildcards = 0;
+      const std::vector<uint32_t>& packets = released[i].second.packets;
+      for (size_t j = 0; j < packets.size (); j++)
+        {
+          FlowTableLookup (key, packets[j], released[i].second.port, false);
+        }
+    }
+}
+
+void
+OpenFlowSwitchNetDevice::ExpirePendingMiss (::flow f)
+{
+  PendingMisses_t::iterator it = m_pendingMisses.find (f);
+  if (it == m_pendingMisses.end ())
+    {
+      return;
+    }
+  PendingMiss miss = it->second;
+  m_pendingMisses.erase (it);
+  NS_LOG_DEBUG ("No flow added in time for " << miss.packets.size () << " held back packets.");
+
+  sw_flow_key key;
+  key.flow = f;
+  key.wildcards = 0;
+  const ofi::ActionProgram *program;
+  for (size_t i = 0; i < miss.packets.size (); i++)
+    {
+      if (LookupFlowCached (&key, &program) != 0)
+        {
+          FlowTableLookup (key, miss.packets[i], miss.port, false);
+        }
+      else if (IsBuffered (miss.packets[i]))
+        {
+          SendMissToController (key, miss.packets[i], miss.port);
+        }
+    }
+}
+
+uint64_t
+OpenFlowSwitchNetDevice::GetCoalescedMisses (void) const
+{
+  return m_coalescedMisses;
+}
+
+uint64_t
+OpenFlowSwitchNetDevice::GetPacketIns (void) const
+{
+  return m_packetIns;
+}
+
+uint64_t
+OpenFlowSwitchNetDevice::GetPacketInMeterDrops (void) const
+{
+  return m_packetInMeterDrops;
+}
+
+size_t
+OpenFlowSwitchNetDevice::FlowHash::operator() (const ::flow& f) const
+{
+  return HashFlowKey (&f);
+}
+
+bool
+OpenFlowSwitchNetDevice::FlowEqual::operator() (const ::flow& a, const ::flow& b) const
+{
+  return memcmp (&a, &b, sizeof a) == 0;
+}
+
+void
+OpenFlowSwitchNetDevice::RunThroughFlowTable (uint32_t packet_uid, int port, bool send_to_controller)
+{
+  HeaderFrame frame;
+  ofpbuf* buffer = PeekHeaders (packet_uid, frame);
+
+  sw_flow_key key;
+  key.wildcards = 0; // Lookup cannot take wildcards.
+  // Extract the matching key's flow data from the packet's headers; if the policy is to drop fragments and the message is a fragment, drop it.
+  // Dropped packets are discarded unless resubmitted by an OFPP_TABLE action, which still uses the buffer.
+  if (flow_extract (buffer, port != -1 ? port : OFPP_NONE, &key.flow) && (m_flags & OFPC_FRAG_MASK) == OFPC_FRAG_DROP)
+    {
+      if (send_to_controller)
+        {
+          DiscardBuffer (packet_uid);
+        }
+      return;
+    }
+
+  // drop MPLS packets with TTL 1
+  if (buffer->l2_5)
+    {
+      mpls_header mpls_h;
+      mpls_h.value = ntohl (*((uint32_t*)buffer->l2_5));
+      if (mpls_h.ttl == 1)
+        {
+          // increment mpls drop counter
           if (port != -1)
             {
               m_ports[port].mpls_ttl0_dropped++;
             }
+          if (send_to_controller)
+            {
+              DiscardBuffer (packet_uid);
+            }
           return;
         }
     }
@@ -1027,18 +1865,73 @@ OpenFlowSwitchNetDevice::RunThroughFlowTable (uint32_t packet_uid, int port, boo
       if (config & (OFPPC_NO_RECV | OFPPC_NO_RECV_STP)
           && config & (!eth_addr_equals (key.flow.dl_dst, stp_eth_addr) ? OFPPC_NO_RECV : OFPPC_NO_RECV_STP))
         {
+          if (send_to_controller)
+            {
+              DiscardBuffer (packet_uid);
+            }
           return;
         }
     }
 
+  if (!send_to_controller)
+    {
+      // Resubmitted by an OFPP_TABLE action. The lookup discards the packet when
+      // done, so it holds it too; the discard of whoever ran the action doesn't drop it.
+      m_packetData[packet_uid & (m_packetData.size () - 1)].users++;
+    }
   NS_LOG_INFO ("Matching against the flow table.");
-  Simulator::Schedule (m_lookupDelay, &OpenFlowSwitchNetDevice::FlowTableLookup, this, key, buffer, packet_uid, port, send_to_controller);
+  ScheduleLookup (key, packet_uid, port, send_to_controller);
+}
+
+void
+OpenFlowSwitchNetDevice::ScheduleLookup (const sw_flow_key& key, uint32_t packet_uid, int port, bool send_to_controller)
+{
+  PendingLookup lookup;
+  lookup.due = Simulator::Now () + m_lookupDelay;
+  lookup.key = key;
+  lookup.packet_uid = packet_uid;
+  lookup.port = port;
+  lookup.send_to_controller = send_to_controller;
+
+  // With a fixed lookup delay this appends; lowering the delay makes the lookup overtake older ones.
+  PendingLookups_t::iterator pos = m_pendingLookups.end ();
+  while (pos != m_pendingLookups.begin () && (pos - 1)->due > lookup.due)
+    {
+      pos--;
+    }
+  bool first = pos == m_pendingLookups.begin ();
+  m_pendingLookups.insert (pos, lookup);
+
+  if (first || !m_lookupEvent.IsRunning ())
+    {
+      m_lookupEvent.Cancel ();
+      m_lookupEvent = Simulator::Schedule (m_pendingLookups.front ().due - Simulator::Now (),
+                                           &OpenFlowSwitchNetDevice::RunPendingLookups, this);
+    }
+}
+
+void
+OpenFlowSwitchNetDevice::RunPendingLookups (void)
+{
+  Time now = Simulator::Now ();
+  while (!m_pendingLookups.empty () && m_pendingLookups.front ().due <= now)
+    {
+      // Copied, since the lookup may queue new ones (OFPP_TABLE).
+      PendingLookup lookup = m_pendingLookups.front ();
+      m_pendingLookups.pop_front ();
+      FlowTableLookup (lookup.key, lookup.packet_uid, lookup.port, lookup.send_to_controller);
+    }
+
+  if (!m_pendingLookups.empty () && !m_lookupEvent.IsRunning ())
+    {
+      m_lookupEvent = Simulator::Schedule (m_pendingLookups.front ().due - now, &OpenFlowSwitchNetDevice::RunPendingLookups, this);
+    }
 }
 
 int
 OpenFlowSwitchNetDevice::RunThroughVPortTable (uint32_t packet_uid, int port, uint32_t vport)
 {
-  ofpbuf* buffer = m_packetData.find (packet_uid)->second.buffer;
+  ofpbuf* buffer = RetrieveBuffer (packet_uid);
 
   // extract the flow again since we need it
   // and the layer pointers may changed
@@ -1059,7 +1952,7 @@ OpenFlowSwitchNetDevice::RunThroughVPortTable (uint32_t packet_uid, int port, ui
     }
   while (vpe != 0)
     {
-      ofi::ExecuteVPortActions (this, packet_uid, m_packetData.find (packet_uid)->second.buffer, &key, vpe->port_acts->actions, vpe->port_acts->actions_len);
+      ofi::ExecuteVPortActions (this, packet_uid, buffer, &key, GetVPortProgram (vpe));
       vport_used (vpe, buffer); // update counters for virtual port
       if (vpe->parent_port_ptr == 0)
         {
@@ -1130,8 +2023,8 @@ int
 OpenFlowSwitchNetDevice::ReceivePacketOut (const void *msg)
 {
   const ofp_packet_out *opo = (ofp_packet_out*)msg;
-  ofpbuf *buffer;
   size_t actions_len = ntohs (opo->actions_len);
+  uint32_t buffer_id = ntohl (opo->buffer_id);
 
   if (actions_len > (ntohs (opo->header.length) - sizeof *opo))
     {
@@ -1139,34 +2032,63 @@ OpenFlowSwitchNetDevice::ReceivePacketOut (const void *msg)
       return -EINVAL;
     }
 
-  if (ntohl (opo->buffer_id) == (uint32_t) -1)
+  if (buffer_id == (uint32_t) -1)
     {
-      // FIXME: can we avoid copying data here?
+      // The controller sent the frame itself; turn it into a packet the ports can send.
       int data_len = ntohs (opo->header.length) - sizeof *opo - actions_len;
-      buffer = ofpbuf_new (data_len);
-      ofpbuf_put (buffer, (uint8_t *)opo->actions + actions_len, data_len);
-    }
-  else
-    {
-      buffer = retrieve_buffer (ntohl (opo->buffer_id));
-      if (buffer == 0)
+      if (data_len < ETH_HEADER_LEN)
         {
-          return -ESRCH;
+          NS_LOG_DEBUG ("packet out carries no frame");
+          return -EINVAL;
         }
+      Ptr<Packet> packet = Create<Packet> ((const uint8_t *)opo->actions + actions_len, data_len);
+      EthernetHeader eth (false);
+      packet->RemoveHeader (eth);
+      buffer_id = SaveBuffer (packet, eth.GetLengthType (), eth.GetSource (), eth.GetDestination ());
+    }
+
+  return ExecutePacketOut (buffer_id, ntohs (opo->in_port), opo->actions, actions_len, opo);
+}
+
+int
+OpenFlowSwitchNetDevice::SendPacketOut (uint32_t buffer_id, uint16_t in_port, const ofp_action_header *actions, size_t actions_len)
+{
+  return ExecutePacketOut (buffer_id, in_port, actions, actions_len, 0);
+}
+
+int
+OpenFlowSwitchNetDevice::SendPacketOut (Ptr<Packet> packet, uint16_t protocol, const Address& src, const Address& dst,
+                                        uint16_t in_port, const ofp_action_header *actions, size_t actions_len)
+{
+  return ExecutePacketOut (SaveBuffer (packet, protocol, src, dst), in_port, actions, actions_len, 0);
+}
+
+int
+OpenFlowSwitchNetDevice::ExecutePacketOut (uint32_t buffer_id, uint16_t in_port, const ofp_action_header *actions, size_t actions_len,
+                                           const ofp_packet_out *opo)
+{
+  ofpbuf *buffer = RetrieveBuffer (buffer_id);
+  if (buffer == 0)
+    {
+      return -ESRCH;
     }
 
   sw_flow_key key;
-  flow_extract (buffer, ntohs(opo->in_port), &key.flow); // ntohs(opo->in_port)
+  flow_extract (buffer, in_port, &key.flow);
 
-  uint16_t v_code = ofi::ValidateActions (&key, opo->actions, actions_len);
+  uint16_t v_code = ofi::ValidateActions (&key, actions, actions_len);
   if (v_code != ACT_VALIDATION_OK)
     {
-      SendErrorMsg (OFPET_BAD_ACTION, v_code, msg, ntohs (opo->header.length));
-      ofpbuf_delete (buffer);
+      if (opo != 0)
+        {
+          SendErrorMsg (OFPET_BAD_ACTION, v_code, opo, ntohs (opo->header.length));
+        }
+      DiscardBuffer (buffer_id);
       return -EINVAL;
     }
 
-  ofi::ExecuteActions (this, opo->buffer_id, buffer, &key, opo->actions, actions_len, true);
+  ofi::ExecuteActions (this, buffer_id, buffer, &key, actions, actions_len, true);
+  DiscardBuffer (buffer_id);
   return 0;
 }
 
@@ -1208,6 +2130,7 @@ OpenFlowSwitchNetDevice::ReceivePortMod (const void *msg)
               /// \todo Possibly enable the Port's Net Device via the appropriate interface.
             }
         }
+      UpdateFloodPorts ();
     }
 
   return 0;
@@ -1226,123 +2149,139 @@ OpenFlowSwitchNetDevice::ReceiveVPortMod (const void *msg)
     }
   else if (command == OFPVP_DELETE)
     {
+      vport_table_entry *vpe = vport_table_lookup (&m_vportTable, ntohl (ovpm->vport));
       if (remove_vport_table_entry (&m_vportTable, ntohl (ovpm->vport)))
         {
           SendErrorMsg (OFPET_BAD_ACTION, OFPET_VPORT_MOD_FAILED, ovpm, ntohs (ovpm->header.length));
         }
+      else
+        {
+          m_vportPrograms.erase (vpe);
+        }
     }
 
   return 0;
 }
 
 int
-OpenFlowSwitchNetDevice::AddFlow (const ofp_flow_mod *ofm)
+OpenFlowSwitchNetDevice::AddFlow (const ofi::FlowSpec& spec, const ofp_flow_mod *ofm)
 {
-  size_t actions_len = ntohs (ofm->header.length) - sizeof *ofm;
+  size_t actions_len = spec.actions_len;
 
   // Allocate memory.
   sw_flow *flow = flow_alloc (actions_len);
   if (flow == 0)
     {
-      if (ntohl (ofm->buffer_id) != (uint32_t) -1)
-        {
-          discard_buffer (ntohl (ofm->buffer_id));
-        }
+      DiscardBuffer (spec.buffer_id);
       return -ENOMEM;
     }
 
-  flow_extract_match (&flow->key, &ofm->match);
+  flow->key = spec.key;
 
-  uint16_t v_code = ofi::ValidateActions (&flow->key, ofm->actions, actions_len);
+  uint16_t v_code = ofi::ValidateActions (&flow->key, spec.actions, actions_len);
   if (v_code != ACT_VALIDATION_OK)
     {
-      SendErrorMsg (OFPET_BAD_ACTION, v_code, ofm, ntohs (ofm->header.length));
-      flow_free (flow);
-      if (ntohl (ofm->buffer_id) != (uint32_t) -1)
+      if (ofm != 0)
         {
-          discard_buffer (ntohl (ofm->buffer_id));
+          SendErrorMsg (OFPET_BAD_ACTION, v_code, ofm, ntohs (ofm->header.length));
         }
+      flow_free (flow);
+      DiscardBuffer (spec.buffer_id);
       return -ENOMEM;
     }
 
   // Fill out flow.
-  flow->priority = flow->key.wildcards ? ntohs (ofm->priority) : -1;
-  flow->idle_timeout = ntohs (ofm->idle_timeout);
-  flow->hard_timeout = ntohs (ofm->hard_timeout);
-  flow->used = flow->created = time_now ();
+  flow->priority = flow->key.wildcards ? spec.priority : -1;
+  flow->idle_timeout = spec.idle_timeout;
+  flow->hard_timeout = spec.hard_timeout;
+  flow->used = flow->created = ofi::FlowTimeNow ();
   flow->sf_acts->actions_len = actions_len;
   flow->byte_count = 0;
   flow->packet_count = 0;
-  memcpy (flow->sf_acts->actions, ofm->actions, actions_len);
+  memcpy (flow->sf_acts->actions, spec.actions, actions_len);
 
-  // Act.
+  // Act. A flow with the same match and priority is replaced; remove it here so
+  // its timer and compiled actions go with it.
+  sw_flow *old = FindFlow (&flow->key, flow->priority);
+  if (old != 0)
+    {
+      RemoveFlow (old);
+    }
   int error = chain_insert (m_chain, flow);
   if (error)
     {
-      if (error == -ENOBUFS)
+      if (error == -ENOBUFS && ofm != 0)
         {
           SendErrorMsg (OFPET_FLOW_MOD_FAILED, OFPFMFC_ALL_TABLES_FULL, ofm, ntohs (ofm->header.length));
         }
       flow_free (flow);
-      if (ntohl (ofm->buffer_id) != (uint32_t) -1)
-        {
-          discard_buffer (ntohl (ofm->buffer_id));
-        }
+      DiscardBuffer (spec.buffer_id);
       return error;
     }
 
+  InvalidateFlowCache ();
+  FlowState& state = m_flowStates[flow];
+  ofi::CompileActions (flow->sf_acts->actions, actions_len, state.program);
+  ArmFlowTimer (flow);
   NS_LOG_INFO ("Added new flow.");
-  if (ntohl (ofm->buffer_id) != std::numeric_limits<uint32_t>::max ())
+  if (spec.buffer_id != std::numeric_limits<uint32_t>::max ())
     {
-      ofpbuf *buffer = retrieve_buffer (ofm->buffer_id); // ntohl(ofm->buffer_id)
+      ofpbuf *buffer = RetrieveBuffer (spec.buffer_id);
       if (buffer)
         {
           sw_flow_key key;
           flow_used (flow, buffer);
-          flow_extract (buffer, ntohs(ofm->match.in_port), &key.flow); // ntohs(ofm->match.in_port);
-          ofi::ExecuteActions (this, ofm->buffer_id, buffer, &key, ofm->actions, actions_len, false);
-          ofpbuf_delete (buffer);
+          flow->used = ofi::FlowTimeNow ();
+          flow_extract (buffer, ntohs (spec.key.flow.in_port), &key.flow);
+          ofi::ExecuteActions (this, spec.buffer_id, buffer, &key, state.program, false);
+          DiscardBuffer (spec.buffer_id);
         }
       else
         {
-          return -ESRCH;
+          error = -ESRCH;
         }
     }
-  return 0;
+
+  // Packets held back behind the one that went to the controller follow it.
+  if (!m_pendingMisses.empty ())
+    {
+      ReleasePendingMisses (&spec.key);
+    }
+  return error;
 }
 
 int
-OpenFlowSwitchNetDevice::ModFlow (const ofp_flow_mod *ofm)
+OpenFlowSwitchNetDevice::ModFlow (const ofi::FlowSpec& spec, const ofp_flow_mod *ofm)
 {
-  sw_flow_key key;
-  flow_extract_match (&key, &ofm->match);
-
-  size_t actions_len = ntohs (ofm->header.length) - sizeof *ofm;
+  size_t actions_len = spec.actions_len;
 
-  uint16_t v_code = ofi::ValidateActions (&key, ofm->actions, actions_len);
+  uint16_t v_code = ofi::ValidateActions (&spec.key, spec.actions, actions_len);
   if (v_code != ACT_VALIDATION_OK)
     {
-      SendErrorMsg ((ofp_error_type)OFPET_BAD_ACTION, v_code, ofm, ntohs (ofm->header.length));
-      if (ntohl (ofm->buffer_id) != (uint32_t) -1)
+      if (ofm != 0)
         {
-          discard_buffer (ntohl (ofm->buffer_id));
+          SendErrorMsg ((ofp_error_type)OFPET_BAD_ACTION, v_code, ofm, ntohs (ofm->header.length));
         }
+      DiscardBuffer (spec.buffer_id);
       return -ENOMEM;
     }
 
-  uint16_t priority = key.wildcards ? ntohs (ofm->priority) : -1;
-  int strict = (ofm->command == htons (OFPFC_MODIFY_STRICT)) ? 1 : 0;
-  chain_modify (m_chain, &key, priority, strict, ofm->actions, actions_len);
+  uint16_t priority = spec.key.wildcards ? spec.priority : -1;
+  int strict = (spec.command == OFPFC_MODIFY_STRICT) ? 1 : 0;
+  if (ModifyFlows (&spec.key, priority, strict, spec.actions, actions_len))
+    {
+      InvalidateFlowCache ();
+    }
 
-  if (ntohl (ofm->buffer_id) != std::numeric_limits<uint32_t>::max ())
+  if (spec.buffer_id != std::numeric_limits<uint32_t>::max ())
     {
-      ofpbuf *buffer = retrieve_buffer (ofm->buffer_id); // ntohl (ofm->buffer_id)
+      ofpbuf *buffer = RetrieveBuffer (spec.buffer_id);
       if (buffer)
         {
           sw_flow_key skb_key;
-          flow_extract (buffer, ntohs(ofm->match.in_port), &skb_key.flow); // ntohs(ofm->match.in_port);
-          ofi::ExecuteActions (this, ofm->buffer_id, buffer, &skb_key, ofm->actions, actions_len, false);
-          ofpbuf_delete (buffer);
+          flow_extract (buffer, ntohs (spec.key.flow.in_port), &skb_key.flow);
+          ofi::ExecuteActions (this, spec.buffer_id, buffer, &skb_key, spec.actions, actions_len, false);
+          DiscardBuffer (spec.buffer_id);
         }
       else
         {
@@ -1357,29 +2296,56 @@ OpenFlowSwitchNetDevice::ReceiveFlow (const void *msg)
 {
   NS_LOG_FUNCTION_NOARGS ();
   const ofp_flow_mod *ofm = (ofp_flow_mod*)msg;
-  uint16_t command = ntohs (ofm->command);
 
-  if (command == OFPFC_ADD)
+  ofi::FlowSpec spec;
+  spec.command = ntohs (ofm->command);
+  flow_extract_match (&spec.key, &ofm->match);
+  spec.priority = ntohs (ofm->priority);
+  spec.idle_timeout = ntohs (ofm->idle_timeout);
+  spec.hard_timeout = ntohs (ofm->hard_timeout);
+  spec.buffer_id = ntohl (ofm->buffer_id);
+  spec.out_port = ofm->out_port;   // Output action ports are stored unconverted too.
+  spec.actions = ofm->actions;
+  spec.actions_len = ntohs (ofm->header.length) - sizeof *ofm;
+  return ApplyFlowMod (spec, ofm);
+}
+
+int
+OpenFlowSwitchNetDevice::InstallFlow (const ofi::FlowSpec& spec)
+{
+  NS_LOG_FUNCTION_NOARGS ();
+  return ApplyFlowMod (spec, 0);
+}
+
+int
+OpenFlowSwitchNetDevice::ApplyFlowMod (const ofi::FlowSpec& spec, const ofp_flow_mod *ofm)
+{
+  if (spec.command == OFPFC_ADD)
     {
-      return AddFlow (ofm);
+      return AddFlow (spec, ofm);
     }
-  else if ((command == OFPFC_MODIFY) || (command == OFPFC_MODIFY_STRICT))
+  else if ((spec.command == OFPFC_MODIFY) || (spec.command == OFPFC_MODIFY_STRICT))
     {
-      return ModFlow (ofm);
+      return ModFlow (spec, ofm);
     }
-  else if (command == OFPFC_DELETE)
+  else if (spec.command == OFPFC_DELETE)
     {
-      sw_flow_key key;
-      flow_extract_match (&key, &ofm->match);
-      return chain_delete (m_chain, &key, ofm->out_port, 0, 0) ? 0 : -ESRCH;
+      if (DeleteFlows (&spec.key, spec.out_port, 0, 0))
+        {
+          InvalidateFlowCache ();
+          return 0;
+        }
+      return -ESRCH;
     }
-  else if (command == OFPFC_DELETE_STRICT)
+  else if (spec.command == OFPFC_DELETE_STRICT)
     {
-      sw_flow_key key;
-      uint16_t priority;
-      flow_extract_match (&key, &ofm->match);
-      priority = key.wildcards ? ntohs (ofm->priority) : -1;
-      return chain_delete (m_chain, &key, ofm->out_port, priority, 1) ? 0 : -ESRCH;
+      uint16_t priority = spec.key.wildcards ? spec.priority : -1;
+      if (DeleteFlows (&spec.key, spec.out_port, priority, 1))
+        {
+          InvalidateFlowCache ();
+          return 0;
+        }
+      return -ESRCH;
     }
   else
     {
@@ -1503,6 +2469,18 @@ OpenFlowSwitchNetDevice::ForwardControlInput (const void *msg, size_t length)
     {
       return -EINVAL;
     }
+  if (m_fromController.IsInstant ())
+    {
+      return ProcessControlInput (msg, length);
+    }
+  // Only the message itself crosses the connection, whatever the caller passed as length.
+  return m_fromController.Send (msg, ntohs (oh->length)) ? 0 : -ENOBUFS;
+}
+
+int
+OpenFlowSwitchNetDevice::ProcessControlInput (const void *msg, size_t length)
+{
+  ofp_header *oh = (ofp_header*) msg;
   assert (oh->version == OFP_VERSION);
 
   int error = 0;
@@ -1548,10 +2526,6 @@ OpenFlowSwitchNetDevice::ForwardControlInput (const void *msg, size_t length)
       error = -EINVAL;
     }
 
-  if (msg != 0)
-    {
-      free ((ofpbuf*)msg);
-    }
   return error;
 }
 
@@ -25,6 +25,7 @@
 #define OPENFLOW_SWITCH_NET_DEVICE_H
 
 #include "ns3/simulator.h"
+#include "ns3/traced-callback.h"
 #include "ns3/log.h"
 #include "ns3/mac48-address.h"
 
@@ -42,11 +43,16 @@
 #include "ns3/string.h"
 #include "ns3/integer.h"
 #include "ns3/uinteger.h"
+#include "ns3/double.h"
 
+#include <deque>
 #include <map>
 #include <set>
+#include <unordered_map>
 
 #include "openflow-interface.h"
+#include "openflow-flow-timer-wheel.h"
+#include "openflow-control-link.h"
 
 namespace ns3 {
 
@@ -92,6 +98,13 @@ public:
    */
   static TypeId GetTypeId (void);
 
+  /// What the switch does with a table miss the packet in meter keeps from the controller.
+  enum PacketInOverflow
+  {
+    OVERFLOW_DROP,      ///< Drop the packet.
+    OVERFLOW_FLOOD      ///< Flood the packet, as a switch without a controller would.
+  };
+
   /**
    * \name Descriptive Data
    * \brief OpenFlowSwitchNetDevice Description Data
@@ -188,12 +201,56 @@ public:
   /**
    * \brief The registered controller calls this method when sending a message to the switch.
    *
+   * Unless the control connection is instant, the message is copied and
+   * handled once it has crossed the connection. Either way the caller keeps
+   * ownership of the message and frees it.
+   *
    * \param msg The message received from the controller.
    * \param length Length of the message.
    * \return 0 if everything's ok, otherwise an error number.
    */
   int ForwardControlInput (const void *msg, size_t length);
 
+  /**
+   * \brief Adds, modifies or deletes flows as an OFPT_FLOW_MOD would, for
+   * controllers running in the same simulation.
+   *
+   * The flow is described in host byte order, and nothing is allocated or
+   * byte-swapped to hand it over. Errors are returned rather than sent to
+   * the controller.
+   *
+   * \param spec The flow mod.
+   * \return 0 if everything's ok, otherwise an error number.
+   */
+  int InstallFlow (const ofi::FlowSpec& spec);
+
+  /**
+   * \brief Runs a list of actions on a buffered packet as an OFPT_PACKET_OUT
+   * would, for controllers running in the same simulation.
+   *
+   * \param buffer_id The ID of the buffered packet, in host order.
+   * \param in_port The port the packet was received over.
+   * \param actions The actions, laid out as in a packet out message.
+   * \param actions_len Length of the actions.
+   * \return 0 if everything's ok, otherwise an error number.
+   */
+  int SendPacketOut (uint32_t buffer_id, uint16_t in_port, const ofp_action_header *actions, size_t actions_len);
+
+  /**
+   * \brief Runs a list of actions on a packet built by the controller.
+   *
+   * \param packet The packet, without its Ethernet header.
+   * \param protocol The protocol number of the packet.
+   * \param src The source address of the packet.
+   * \param dst The destination address of the packet.
+   * \param in_port The port the packet counts as received over.
+   * \param actions The actions, laid out as in a packet out message.
+   * \param actions_len Length of the actions.
+   * \return 0 if everything's ok, otherwise an error number.
+   */
+  int SendPacketOut (Ptr<Packet> packet, uint16_t protocol, const Address& src, const Address& dst,
+                     uint16_t in_port, const ofp_action_header *actions, size_t actions_len);
+
   /**
    * \return The flow table chain.
    */
@@ -221,6 +278,57 @@ public:
    */
   vport_table_t GetVPortTable ();
 
+  /**
+   * \return Number of packet buffers; fixed by the BufferSlotBits attribute.
+   */
+  uint32_t GetNBuffers (void) const;
+
+  /**
+   * \return Number of buffered packets dropped to make room for newer ones.
+   */
+  uint64_t GetBufferEvictions (void) const;
+
+  /**
+   * \return Number of flow table lookups answered by the exact-match flow cache.
+   */
+  uint64_t GetFlowCacheHits (void) const;
+
+  /**
+   * \return Number of flow table lookups that missed the exact-match flow cache and walked the chain.
+   */
+  uint64_t GetFlowCacheMisses (void) const;
+
+  /**
+   * \return Number of control messages delivered, in both directions.
+   */
+  uint64_t GetControlMessages (void) const;
+
+  /**
+   * \return Number of control messages dropped because the control connection queue was full, in both directions.
+   */
+  uint64_t GetControlDrops (void) const;
+
+  /**
+   * \return Total time the delivered control messages waited in the control connection queues.
+   */
+  Time GetControlQueueingDelay (void) const;
+
+  /**
+   * \return Number of table misses held back instead of being sent to the controller,
+   * because an earlier packet of the same flow was already with it.
+   */
+  uint64_t GetCoalescedMisses (void) const;
+
+  /**
+   * \return Number of packet ins sent to the controller.
+   */
+  uint64_t GetPacketIns (void) const;
+
+  /**
+   * \return Number of packet ins the packet in meter kept from the controller.
+   */
+  uint64_t GetPacketInMeterDrops (void) const;
+
   // From NetDevice
   virtual void SetIfIndex (const uint32_t index);
   virtual uint32_t GetIfIndex (void) const;
@@ -264,34 +372,58 @@ protected:
 
   /**
    * Takes a packet and generates an OpenFlow buffer from it, loading the packet data as well as its headers.
+   * The buffer is sized to the packet, plus headroom for headers added in forwarding.
    *
    * \param packet The packet.
    * \param src The source address.
    * \param dst The destination address.
-   * \param mtu The Maximum Transmission Unit.
    * \param protocol The protocol defining the packet.
    * \return The OpenFlow Buffer created from the packet.
    */
-  ofpbuf * BufferFromPacket (Ptr<const Packet> packet, Address src, Address dst, int mtu, uint16_t protocol);
+  ofpbuf * BufferFromPacket (Ptr<const Packet> packet, Address src, Address dst, uint16_t protocol);
 
 private:
+  /**
+   * Add, modify or delete flows, depending on the command of the flow mod.
+   *
+   * \param spec The flow mod.
+   * \param ofm The message it was decoded from, to report errors against; 0 for native calls.
+   * \return 0 if everything's ok, otherwise an error number.
+   */
+  int ApplyFlowMod (const ofi::FlowSpec& spec, const ofp_flow_mod *ofm);
+
   /**
    * Add a flow.
    *
    * \sa #ENOMEM, #ENOBUFS, #ESRCH
    *
-   * \param ofm The flow data to add.
+   * \param spec The flow data to add.
+   * \param ofm The message it was decoded from, to report errors against; 0 for native calls.
    * \return 0 if everything's ok, otherwise an error number.
    */
-  int AddFlow (const ofp_flow_mod *ofm);
+  int AddFlow (const ofi::FlowSpec& spec, const ofp_flow_mod *ofm);
 
   /**
    * Modify a flow.
    *
-   * \param ofm The flow data to modify.
+   * \param spec The flow data to modify.
+   * \param ofm The message it was decoded from, to report errors against; 0 for native calls.
+   * \return 0 if everything's ok, otherwise an error number.
+   */
+  int ModFlow (const ofi::FlowSpec& spec, const ofp_flow_mod *ofm);
+
+  /**
+   * Run a list of actions on a buffered packet and release it.
+   *
+   * \param buffer_id The ID of the buffered packet.
+   * \param in_port The port the packet was received over.
+   * \param actions The actions.
+   * \param actions_len Length of the actions.
+   * \param opo The message the actions came in, to report errors against; 0 for native calls.
    * \return 0 if everything's ok, otherwise an error number.
    */
-  int ModFlow (const ofp_flow_mod *ofm);
+  int ExecutePacketOut (uint32_t buffer_id, uint16_t in_port, const ofp_action_header *actions, size_t actions_len,
+                        const ofp_packet_out *opo);
 
   /**
    * Send packets out all the ports except the originating one
@@ -310,6 +442,20 @@ private:
    */
   void OutputPacket (uint32_t packet_uid, int out_port);
 
+  /**
+   * Sends a copy of the Packet over the provided output port.
+   *
+   * \param data Metadata of the packet, already fetched by the caller.
+   * \param out_port The port to send the Packet over.
+   */
+  void OutputPacket (const ofi::SwitchPacketMetadata& data, int out_port);
+
+  /**
+   * Recompute the set of ports a flood goes out on; called whenever a port
+   * is added or its config or link state changes.
+   */
+  void UpdateFloodPorts (void);
+
   /**
    * Seeks to send out a Packet over the provided output port. This is called generically
    * when we may or may not know the specific port we're outputting on. There are many
@@ -332,8 +478,19 @@ private:
    * \param in_port The index of the port the Packet was initially received on.
    * \param max_len The maximum number of bytes that the caller wants to be sent; a value of 0 indicates the entire packet should be sent.
    * \param reason Why the packet is being sent.
+   * \return false if the packet in meter kept the packet from the controller.
+   */
+  bool OutputControl (uint32_t packet_uid, int in_port, size_t max_len, int reason);
+
+  /**
+   * Sends a packet that missed the flow table to the controller, or handles
+   * it as PacketInOverflow says if the packet in meter keeps it from there.
+   *
+   * \param key Exact-match key of the packet.
+   * \param packet_uid Packet UID; used to fetch the packet and its metadata.
+   * \param in_port The index of the port the Packet was initially received on.
    */
-  void OutputControl (uint32_t packet_uid, int in_port, size_t max_len, int reason);
+  void SendMissToController (const sw_flow_key& key, uint32_t packet_uid, int in_port);
 
   /**
    * If an error message happened during the controller's request, send it to the controller.
@@ -400,6 +557,46 @@ private:
    */
   int SendOpenflowBuffer (ofpbuf *buffer);
 
+  /**
+   * Handle a message from the controller once it has crossed the control connection.
+   *
+   * \param msg The message; not freed, it belongs to the caller or the control connection.
+   * \param length Length of the message.
+   * \return 0 if everything's ok, otherwise an error number.
+   */
+  int ProcessControlInput (const void *msg, size_t length);
+
+  /**
+   * Hand a message that crossed the control connection to the controller.
+   *
+   * \param msg The message.
+   * \param length Length of the message.
+   */
+  void DeliverToController (const uint8_t *msg, size_t length);
+
+  /**
+   * Handle a message that crossed the control connection from the controller.
+   *
+   * \param msg The message.
+   * \param length Length of the message.
+   */
+  void DeliverFromController (const uint8_t *msg, size_t length);
+
+  /**
+   * \name Control connection attributes
+   *
+   * Both directions of the control connection share the settings.
+   *
+   * @{
+   */
+  void SetControlDelay (Time delay);
+  Time GetControlDelay (void) const;
+  void SetControlDataRate (DataRate rate);
+  DataRate GetControlDataRate (void) const;
+  void SetControlQueueSize (uint32_t size);
+  uint32_t GetControlQueueSize (void) const;
+  /**@}*/
+
   /**
    * Run the packet through the flow table. Looks up in the flow table for a match.
    * If it doesn't match, it forwards the packet to the registered controller, if the flag is set.
@@ -422,16 +619,208 @@ private:
   int RunThroughVPortTable (uint32_t packet_uid, int port, uint32_t vport);
 
   /**
-   * Called by RunThroughFlowTable on a scheduled delay
+   * Queue a flow table lookup to run once the lookup delay has passed.
+   * All lookups due at the same time share one scheduled event.
+   *
+   * \param key Matching key to look up in the flow table.
+   * \param packet_uid Packet UID; used to fetch the packet and its metadata.
+   * \param port The port the packet was received over.
+   * \param send_to_controller If set, sends to the controller if the packet isn't matched.
+   */
+  void ScheduleLookup (const sw_flow_key& key, uint32_t packet_uid, int port, bool send_to_controller);
+
+  /**
+   * Run every queued lookup that is due, then schedule the next batch.
+   */
+  void RunPendingLookups (void);
+
+  /**
+   * Called by RunPendingLookups once the lookup delay has passed
    * to account for the flow table lookup overhead.
    *
    * \param key Matching key to look up in the flow table.
-   * \param buffer Buffer of the packet received.
    * \param packet_uid Packet UID; used to fetch the packet and its metadata.
    * \param port The port the packet was received over.
    * \param send_to_controller 
    */
-  void FlowTableLookup (sw_flow_key key, ofpbuf* buffer, uint32_t packet_uid, int port, bool send_to_controller);
+  void FlowTableLookup (sw_flow_key key, uint32_t packet_uid, int port, bool send_to_controller);
+
+  /**
+   * Look up an exact-match key, first in the flow cache and then in the flow table chain.
+   * A chain match is stored in the cache so later packets of the same flow skip the chain walk;
+   * the lookup and matched counters of the tables are bumped either way.
+   *
+   * \param key Exact-match key extracted from a received packet.
+   * \param program Set to the compiled actions of the matching flow, if there is one.
+   * \return The matching flow, or 0 if there is none.
+   */
+  sw_flow* LookupFlowCached (const sw_flow_key *key, const ofi::ActionProgram **program);
+
+  /**
+   * Hold back a packet that missed the flow table if an earlier packet of
+   * its flow is already with the controller. Otherwise the packet is to be
+   * sent to the controller, and the next packets of its flow are held until
+   * a flow covering them is added or PendingMissTimeout passes.
+   *
+   * \param key Exact-match key of the packet.
+   * \param packet_uid Packet UID of the packet.
+   * \param port The port the packet was received over.
+   * \return true if the packet is held; false if it has to go to the controller.
+   */
+  bool HoldMiss (const sw_flow_key& key, uint32_t packet_uid, int port);
+
+  /**
+   * Run the packets held back for the flows a new flow covers through the flow table.
+   *
+   * \param match Match of the new flow.
+   */
+  void ReleasePendingMisses (const sw_flow_key *match);
+
+  /**
+   * No flow covering a held back flow was added in time: forward its
+   * packets if a flow matches them by now, and send them to the controller otherwise.
+   *
+   * \param key Exact-match flow fields of the held packets.
+   */
+  void ExpirePendingMiss (::flow key);
+
+  /**
+   * Get the compiled actions of a virtual port table entry, as compiled when it was added.
+   *
+   * \param vpe An entry of the virtual port table.
+   * \return The entry's compiled actions.
+   */
+  const ofi::ActionProgram& GetVPortProgram (const vport_table_entry *vpe);
+
+  /**
+   * Arm the expiration timer of a flow just added to the flow table chain.
+   * Nothing is armed for a permanent flow.
+   *
+   * \param flow The flow.
+   */
+  void ArmFlowTimer (sw_flow *flow);
+
+  /**
+   * Make sure the flow timer wheel is advanced when its next timer is due.
+   */
+  void ScheduleFlowExpiry (void);
+
+  /**
+   * Expire the flows whose timers are due, notify the controller, and re-arm
+   * the timers of flows that were used since they were armed.
+   */
+  void ExpireFlows (void);
+
+  /**
+   * Find the flow a strict delete of a match and priority would remove.
+   *
+   * \param key The match, wildcards included.
+   * \param priority The priority.
+   * \return The flow, or 0 if the chain has none.
+   */
+  sw_flow* FindFlow (const sw_flow_key *key, uint16_t priority);
+
+  /**
+   * Remove a flow from the flow table chain and free it, with its timer and
+   * compiled actions. The caller invalidates the flow cache.
+   *
+   * \param flow A flow of the chain.
+   */
+  void RemoveFlow (sw_flow *flow);
+
+  /**
+   * Remove the flows a flow mod's delete command covers, as chain_delete would.
+   * The caller invalidates the flow cache.
+   *
+   * \param key The match, wildcards included.
+   * \param out_port Output port the flows must have, or OFPP_NONE for any.
+   * \param priority Priority of the flow, for a strict delete.
+   * \param strict Nonzero to remove only the flow with exactly this match and priority.
+   * \return The number of flows removed.
+   */
+  int DeleteFlows (const sw_flow_key *key, uint16_t out_port, uint16_t priority, int strict);
+
+  /**
+   * Replace the actions of the flows a flow mod's modify command covers, as
+   * chain_modify would, and recompile them. The caller invalidates the flow cache.
+   *
+   * \param key The match, wildcards included.
+   * \param priority Priority of the flow, for a strict modify.
+   * \param strict Nonzero to modify only the flow with exactly this match and priority.
+   * \param actions The new, validated actions.
+   * \param actions_len Length of the actions buffer.
+   * \return The number of flows modified.
+   */
+  int ModifyFlows (const sw_flow_key *key, uint16_t priority, int strict, const ofp_action_header *actions, size_t actions_len);
+
+  /**
+   * Invalidate every entry of the flow cache. Must be called whenever a flow
+   * is added to, modified in or removed from the flow table chain.
+   */
+  void InvalidateFlowCache (void);
+
+  /**
+   * Leading bytes of a packet's frame, enough for flow_extract to parse
+   * every header it looks at.
+   */
+  struct HeaderFrame
+  {
+    ofpbuf buffer;               ///< Wraps data.
+    uint8_t data[128];           ///< Ethernet header followed by the start of the packet.
+  };
+
+  /**
+   * Get the headers of a buffered packet for flow key extraction.
+   * Unless the OpenFlow buffer of the packet was already built, only the
+   * Ethernet header and the first bytes of the packet are copied into frame.
+   *
+   * \param packet_uid Packet UID; used to fetch the packet and its metadata.
+   * \param frame Storage for the headers; must outlive the returned buffer.
+   * \return The OpenFlow buffer of the packet, or frame's buffer.
+   */
+  ofpbuf* PeekHeaders (uint32_t packet_uid, HeaderFrame& frame);
+
+  /**
+   * Buffer a packet: take a slot from the free list, or drop the oldest
+   * buffered packet if there is none, and store the packet there.
+   * Its OpenFlow buffer is only built once something asks for it.
+   *
+   * \param packet The Packet itself.
+   * \param protocol The protocol defining the Packet.
+   * \param src The source address of the Packet.
+   * \param dst The destination address of the Packet.
+   * \return The packet UID; the slot index in the low BufferSlotBits bits and a cookie above them.
+   */
+  uint32_t SaveBuffer (Ptr<Packet> packet, uint16_t protocol, const Address& src, const Address& dst);
+
+  /**
+   * \param packet_uid Packet UID, as handed to the controller in a buffer_id.
+   * \return true if the packet is still buffered.
+   */
+  bool IsBuffered (uint32_t packet_uid) const;
+
+  /**
+   * Get the OpenFlow buffer of a buffered packet, building it from the Packet on first use.
+   *
+   * \param packet_uid Packet UID, as handed to the controller in a buffer_id.
+   * \return The OpenFlow buffer of the packet, or 0 if it is no longer buffered.
+   */
+  ofpbuf* RetrieveBuffer (uint32_t packet_uid);
+
+  /**
+   * \param packet_uid Packet UID; used to fetch the packet and its metadata.
+   * \return The metadata stored for the packet.
+   */
+  ofi::SwitchPacketMetadata& GetPacketData (uint32_t packet_uid);
+
+  /**
+   * Drop a buffered packet and return its slot to the free list, once every
+   * lookup an OFPP_TABLE action queued for it has discarded it too.
+   * Nothing happens if the packet is no longer buffered.
+   *
+   * \param packet_uid Packet UID; used to fetch the packet and its metadata.
+   */
+  void DiscardBuffer (uint32_t packet_uid);
 
   /**
    * Update the port status field of the switch port.
@@ -442,6 +831,13 @@ private:
    */
   int UpdatePortStatus (ofi::Port& p);
 
+  /**
+   * Called by the port net devices when one of their links goes up or down.
+   * Every port whose status changed is reported to the controller right
+   * away, without waiting for traffic to cross the switch.
+   */
+  void PortLinkChanged (void);
+
   /**
    * Fill out a description of the switch port.
    *
@@ -494,22 +890,130 @@ private:
   uint32_t m_ifIndex;                   ///< Interface Index
   uint16_t m_mtu;                       ///< Maximum Transmission Unit
 
-  typedef std::map<uint32_t,ofi::SwitchPacketMetadata> PacketData_t;
-  PacketData_t m_packetData;            ///< Packet data
+  /// Slot of the packet buffer store.
+  struct PacketSlot
+  {
+    uint32_t packet_uid;                ///< UID of the packet held; -1 if the slot is free.
+    uint32_t cookie;                    ///< Cookie of the last packet held; tells reuses of the slot apart.
+    uint32_t users;                     ///< Discards it takes to drop the packet: one, plus one per pending OFPP_TABLE lookup.
+    uint32_t older;                     ///< Previous slot in buffering order; -1 if this is the oldest.
+    uint32_t newer;                     ///< Next slot in buffering order; -1 if this is the newest.
+    ofi::SwitchPacketMetadata data;     ///< Metadata of that packet; owns data.buffer, 0 until built.
+  };
+
+  typedef std::vector<PacketSlot> PacketData_t;
+  PacketData_t m_packetData;            ///< Packet buffers, indexed by the slot bits of the packet UID.
+  std::vector<uint32_t> m_freeSlots;    ///< Free list of packet buffer slots.
+  uint32_t m_oldestSlot;                ///< Slot buffered first; evicted when no slot is free.
+  uint32_t m_newestSlot;                ///< Slot buffered last.
+  uint32_t m_bufferSlotBits;            ///< Number of packet UID bits selecting the slot; the rest is cookie.
+  uint64_t m_bufferEvictions;           ///< Buffered packets dropped to make room.
 
   typedef std::vector<ofi::Port> Ports_t;
   Ports_t m_ports;                      ///< Switch's ports
+  std::vector<uint32_t> m_floodPorts;   ///< Indices of the ports without OFPPC_NO_FLOOD whose link is up.
+  TracedCallback<> m_linkChangeCallbacks; ///< Callbacks fired when the link state of a port changes.
 
   Ptr<ofi::Controller> m_controller;    ///< Connection to controller.
 
   uint64_t m_id;                        ///< Unique identifier for this switch, needed for OpenFlow
   Time m_lookupDelay;                   ///< Flow Table Lookup Delay [overhead].
 
-  Time m_lastExecute;                   ///< Last time the periodic execution occurred.
+  /// A flow table lookup waiting for the lookup delay to pass.
+  struct PendingLookup
+  {
+    Time due;                           ///< Time the lookup runs at.
+    sw_flow_key key;                    ///< Matching key to look up in the flow table.
+    uint32_t packet_uid;                ///< Packet UID of the packet looked up.
+    int port;                           ///< Port the packet was received over.
+    bool send_to_controller;            ///< Whether a miss goes to the controller.
+  };
+
+  typedef std::deque<PendingLookup> PendingLookups_t;
+  PendingLookups_t m_pendingLookups;    ///< Pending lookups, sorted by due time.
+  EventId m_lookupEvent;                ///< Event running the next batch of pending lookups.
+
   uint16_t m_flags;                     ///< Flags; configurable by the controller.
   uint16_t m_missSendLen;               ///< Flow Table Miss Send Length; configurable by the controller.
 
   sw_chain *m_chain;             ///< Flow Table; forwarding rules.
+
+  /// Entry of the exact-match flow cache.
+  struct FlowCacheEntry
+  {
+    FlowCacheEntry () : generation (0), flow (0), table (0), program (0)
+    {
+    }
+
+    uint32_t generation;         ///< Flow table generation the entry was stored under; stale if it differs.
+    ::flow key;                  ///< Exact-match flow fields of the cached packet.
+    sw_flow *flow;               ///< Flow the key resolved to.
+    int table;                   ///< Index in the chain of the table holding the flow.
+    const ofi::ActionProgram *program; ///< Compiled actions of the flow.
+  };
+
+  typedef std::vector<FlowCacheEntry> FlowCache_t;
+  FlowCache_t m_flowCache;       ///< Direct-mapped exact-match flow cache in front of m_chain.
+  uint32_t m_flowCacheSize;      ///< Number of flow cache entries; 0 disables the cache.
+  uint32_t m_flowGeneration;     ///< Flow table generation; bumped on every flow table change.
+  uint64_t m_flowCacheHits;      ///< Lookups answered by the flow cache.
+  uint64_t m_flowCacheMisses;    ///< Lookups that had to walk the flow table chain.
+
+  /// Hash of the exact-match flow fields of a packet.
+  struct FlowHash
+  {
+    size_t operator() (const ::flow& f) const;
+  };
+
+  /// Equality of the exact-match flow fields of two packets.
+  struct FlowEqual
+  {
+    bool operator() (const ::flow& a, const ::flow& b) const;
+  };
+
+  /// Packets of a flow held back while its first packet is with the controller.
+  struct PendingMiss
+  {
+    int port;                        ///< Port the packets were received over.
+    std::vector<uint32_t> packets;   ///< Packet UIDs held back, in arrival order.
+    EventId timeout;                 ///< Event giving up on the controller adding a flow.
+  };
+
+  typedef std::unordered_map< ::flow, PendingMiss, FlowHash, FlowEqual> PendingMisses_t;
+  PendingMisses_t m_pendingMisses; ///< Flows missed and sent to the controller, by exact-match fields.
+  uint32_t m_pendingMissQueueSize; ///< Packets held back per flow; 0 disables holding.
+  Time m_pendingMissTimeout;       ///< Time held packets wait for a flow.
+  uint64_t m_coalescedMisses;      ///< Misses held back instead of sent to the controller.
+
+  double m_packetInRate;           ///< Packet ins sent per second; 0 for no limit.
+  uint32_t m_packetInBurst;        ///< Packet ins sent at once.
+  PacketInOverflow m_packetInOverflow; ///< Handling of the misses over the rate.
+  ofi::TokenBucket m_packetInMeter; ///< Meter of the packet ins.
+  uint64_t m_packetIns;            ///< Packet ins sent.
+  uint64_t m_packetInMeterDrops;   ///< Packet ins kept from the controller by the meter.
+
+  /// What the switch keeps alongside a flow of m_chain.
+  struct FlowState
+  {
+    FlowState () : serial (0)
+    {
+    }
+
+    uint64_t serial;             ///< Serial of the flow's timer; 0 if it has none. Stale timers carry an older one.
+    ofi::ActionProgram program;  ///< The flow's compiled actions.
+  };
+
+  typedef std::unordered_map<const sw_flow*, FlowState> FlowStates_t;
+  FlowStates_t m_flowStates;         ///< State of each flow in m_chain; compiled as the flow is added or modified.
+  typedef std::unordered_map<const vport_table_entry*, ofi::ActionProgram> VPortPrograms_t;
+  VPortPrograms_t m_vportPrograms;   ///< Compiled actions of the virtual port table entries; compiled as they are added.
+
+  ofi::FlowTimerWheel m_flowTimers;  ///< Expiration timers of the flows, one tick per second.
+  uint64_t m_nextFlowSerial;         ///< Serial of the last flow timer armed.
+  EventId m_expiryEvent;             ///< Event advancing the flow timer wheel.
+  uint64_t m_expiryTick;             ///< Tick m_expiryEvent is scheduled for.
+  ofi::ControlLink m_toController;   ///< Control connection from the switch to the controller.
+  ofi::ControlLink m_fromController; ///< Control connection from the controller to the switch.
   vport_table_t m_vportTable;    ///< Virtual Port Table
 };
 
@@ -0,0 +1,484 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifdef NS3_OPENFLOW
+
+#include "openflow-tuple-space-table.h"
+
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("OpenFlowTupleSpaceTable");
+
+namespace ofi {
+
+namespace {
+
+/// Flows sharing one masked key, highest priority first, then oldest first.
+typedef std::vector<sw_flow*> Bucket_t;
+
+/// All flows with the same wildcard mask.
+struct Tuple
+{
+  uint32_t wildcards;                              ///< Wildcard mask shared by the flows.
+  uint16_t max_priority;                           ///< Highest priority of the flows.
+  unsigned int n_flows;                            ///< Number of flows.
+  std::unordered_map<uint32_t, Bucket_t> buckets;  ///< Masked key hash -> flows.
+};
+
+struct TupleSpace
+{
+  sw_table swt;                          ///< Must come first; OFSID only sees this part.
+  unsigned int max_flows;
+  unsigned int n_flows;
+  unsigned long int next_serial;
+  std::map<uint32_t, Tuple*> tuples;     ///< Wildcard mask -> tuple.
+  std::vector<Tuple*> order;             ///< Tuples by decreasing max_priority.
+  std::map<unsigned long int, sw_flow*> flows; ///< Serial -> flow, for iteration and bulk operations.
+};
+
+uint32_t
+NwMask (uint32_t wildcards, int shift)
+{
+  uint32_t n_wild = (wildcards >> shift) & ((1 << OFPFW_NW_SRC_BITS) - 1);
+  return n_wild >= 32 ? 0 : htonl (~((1u << n_wild) - 1));
+}
+
+/**
+ * Hash the fields of a flow key that the wildcard mask keeps. Fields not
+ * covered here only cause extra candidates; matches are always confirmed
+ * with flow_matches_1wild.
+ */
+uint32_t
+HashMasked (const flow *f, uint32_t wildcards)
+{
+  flow m;
+  memset (&m, 0, sizeof m);
+  if (!(wildcards & OFPFW_IN_PORT))
+    {
+      m.in_port = f->in_port;
+    }
+  if (!(wildcards & OFPFW_DL_VLAN))
+    {
+      m.dl_vlan = f->dl_vlan;
+    }
+  if (!(wildcards & OFPFW_DL_SRC))
+    {
+      memcpy (m.dl_src, f->dl_src, sizeof m.dl_src);
+    }
+  if (!(wildcards & OFPFW_DL_DST))
+    {
+      memcpy (m.dl_dst, f->dl_dst, sizeof m.dl_dst);
+    }
+  if (!(wildcards & OFPFW_DL_TYPE))
+    {
+      m.dl_type = f->dl_type;
+    }
+  if (!(wildcards & OFPFW_NW_PROTO))
+    {
+      m.nw_proto = f->nw_proto;
+    }
+  if (!(wildcards & OFPFW_TP_SRC))
+    {
+      m.tp_src = f->tp_src;
+    }
+  if (!(wildcards & OFPFW_TP_DST))
+    {
+      m.tp_dst = f->tp_dst;
+    }
+  m.nw_src = f->nw_src & NwMask (wildcards, OFPFW_NW_SRC_SHIFT);
+  m.nw_dst = f->nw_dst & NwMask (wildcards, OFPFW_NW_DST_SHIFT);
+
+  // FNV-1a
+  const uint8_t *p = (const uint8_t *)&m;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < sizeof m; i++)
+    {
+      hash ^= p[i];
+      hash *= 16777619u;
+    }
+  return hash;
+}
+
+/// True if a should be preferred over b.
+bool
+Precedes (const sw_flow *a, const sw_flow *b)
+{
+  return a->priority > b->priority || (a->priority == b->priority && a->serial < b->serial);
+}
+
+bool
+TupleOrder (const Tuple *a, const Tuple *b)
+{
+  return a->max_priority > b->max_priority;
+}
+
+void
+Reorder (TupleSpace *ts)
+{
+  std::stable_sort (ts->order.begin (), ts->order.end (), TupleOrder);
+}
+
+/// Unlinks the flow from the table without freeing it.
+void
+Remove (TupleSpace *ts, sw_flow *flow)
+{
+  std::map<uint32_t, Tuple*>::iterator ti = ts->tuples.find (flow->key.wildcards);
+  NS_ASSERT (ti != ts->tuples.end ());
+  Tuple *t = ti->second;
+
+  uint32_t hash = HashMasked (&flow->key.flow, t->wildcards);
+  Bucket_t& bucket = t->buckets[hash];
+  bucket.erase (std::find (bucket.begin (), bucket.end (), flow));
+  if (bucket.empty ())
+    {
+      t->buckets.erase (hash);
+    }
+  ts->flows.erase (flow->serial);
+  ts->n_flows--;
+
+  if (--t->n_flows == 0)
+    {
+      ts->order.erase (std::find (ts->order.begin (), ts->order.end (), t));
+      ts->tuples.erase (ti);
+      delete t;
+    }
+  else if (flow->priority == t->max_priority)
+    {
+      t->max_priority = 0;
+      for (std::unordered_map<uint32_t, Bucket_t>::iterator b = t->buckets.begin (); b != t->buckets.end (); b++)
+        {
+          t->max_priority = std::max (t->max_priority, b->second.front ()->priority);
+        }
+      Reorder (ts);
+    }
+}
+
+/// The flow with exactly this match and priority; there is at most one.
+sw_flow *
+FindStrict (TupleSpace *ts, const sw_flow_key *key, uint16_t priority)
+{
+  std::map<uint32_t, Tuple*>::const_iterator ti = ts->tuples.find (key->wildcards);
+  if (ti == ts->tuples.end ())
+    {
+      return 0;
+    }
+  std::unordered_map<uint32_t, Bucket_t>::const_iterator b = ti->second->buckets.find (HashMasked (&key->flow, key->wildcards));
+  if (b == ti->second->buckets.end ())
+    {
+      return 0;
+    }
+  for (Bucket_t::const_iterator f = b->second.begin (); f != b->second.end (); f++)
+    {
+      if ((*f)->priority == priority && flow_del_matches (&(*f)->key, key, 1))
+        {
+          return *f;
+        }
+    }
+  return 0;
+}
+
+sw_flow *
+TupleSpaceLookup (sw_table *swt, const sw_flow_key *key)
+{
+  TupleSpace *ts = (TupleSpace *)swt;
+  sw_flow *best = 0;
+
+  for (std::vector<Tuple*>::const_iterator i = ts->order.begin (); i != ts->order.end (); i++)
+    {
+      const Tuple *t = *i;
+      if (best != 0 && best->priority > t->max_priority)
+        {
+          break; // No remaining tuple can hold a better flow.
+        }
+
+      std::unordered_map<uint32_t, Bucket_t>::const_iterator b = t->buckets.find (HashMasked (&key->flow, t->wildcards));
+      if (b == t->buckets.end ())
+        {
+          continue;
+        }
+      for (Bucket_t::const_iterator f = b->second.begin (); f != b->second.end (); f++)
+        {
+          if (best != 0 && !Precedes (*f, best))
+            {
+              break;
+            }
+          if (flow_matches_1wild (key, &(*f)->key))
+            {
+              best = *f;
+              break;
+            }
+        }
+    }
+  return best;
+}
+
+int
+TupleSpaceInsert (sw_table *swt, sw_flow *flow)
+{
+  TupleSpace *ts = (TupleSpace *)swt;
+
+  Tuple *t;
+  std::map<uint32_t, Tuple*>::iterator ti = ts->tuples.find (flow->key.wildcards);
+  if (ti != ts->tuples.end ())
+    {
+      t = ti->second;
+    }
+  else
+    {
+      if (ts->n_flows >= ts->max_flows)
+        {
+          return 0;
+        }
+      t = new Tuple;
+      t->wildcards = flow->key.wildcards;
+      t->max_priority = flow->priority;
+      t->n_flows = 0;
+      ts->tuples.insert (std::make_pair (t->wildcards, t));
+      ts->order.push_back (t);
+    }
+
+  // Replace a flow with the same match and priority, as the linear table does.
+  uint32_t hash = HashMasked (&flow->key.flow, t->wildcards);
+  std::unordered_map<uint32_t, Bucket_t>::iterator b = t->buckets.find (hash);
+  if (b != t->buckets.end ())
+    {
+      for (Bucket_t::iterator f = b->second.begin (); f != b->second.end (); f++)
+        {
+          if ((*f)->priority == flow->priority && flow_matches_2wild (&(*f)->key, &flow->key))
+            {
+              flow->serial = (*f)->serial;
+              ts->flows[flow->serial] = flow;
+              flow_free (*f);
+              *f = flow;
+              return 1;
+            }
+        }
+    }
+
+  // Only create the bucket once the flow is sure to go in; Remove () expects no empty ones.
+  if (ts->n_flows >= ts->max_flows)
+    {
+      return 0;
+    }
+
+  Bucket_t& bucket = t->buckets[hash];
+  flow->serial = ts->next_serial++;
+  Bucket_t::iterator pos = bucket.begin ();
+  while (pos != bucket.end () && Precedes (*pos, flow))
+    {
+      pos++;
+    }
+  bucket.insert (pos, flow);
+  ts->flows.insert (std::make_pair (flow->serial, flow));
+  ts->n_flows++;
+  t->n_flows++;
+
+  if (t->n_flows == 1 || flow->priority > t->max_priority)
+    {
+      t->max_priority = flow->priority;
+      Reorder (ts);
+    }
+  return 1;
+}
+
+int
+TupleSpaceModify (sw_table *swt, const sw_flow_key *key, uint16_t priority, int strict,
+                  const ofp_action_header *actions, size_t actions_len)
+{
+  TupleSpace *ts = (TupleSpace *)swt;
+  unsigned int count = 0;
+
+  for (std::map<unsigned long int, sw_flow*>::iterator i = ts->flows.begin (); i != ts->flows.end (); i++)
+    {
+      sw_flow *flow = i->second;
+      if (flow_del_matches (&flow->key, key, strict) && (!strict || flow->priority == priority))
+        {
+          flow_replace_acts (flow, actions, actions_len);
+          count++;
+        }
+    }
+  return count;
+}
+
+int
+TupleSpaceDelete (sw_table *swt, const sw_flow_key *key, uint16_t out_port, uint16_t priority, int strict)
+{
+  TupleSpace *ts = (TupleSpace *)swt;
+  unsigned int count = 0;
+
+  if (strict)
+    {
+      // Only one flow can match exactly; it sits in the bucket of its own masked key.
+      sw_flow *flow = FindStrict (ts, key, priority);
+      if (flow == 0 || !flow_has_out_port (flow, out_port))
+        {
+          return 0;
+        }
+      Remove (ts, flow);
+      flow_free (flow);
+      return 1;
+    }
+
+  std::map<unsigned long int, sw_flow*>::iterator i = ts->flows.begin ();
+  while (i != ts->flows.end ())
+    {
+      sw_flow *flow = (i++)->second; // Remove () erases the current entry.
+      if (flow_del_matches (&flow->key, key, 0) && flow_has_out_port (flow, out_port))
+        {
+          Remove (ts, flow);
+          flow_free (flow);
+          count++;
+        }
+    }
+  return count;
+}
+
+int
+TupleSpaceTimeout (sw_table *swt, List *deleted)
+{
+  TupleSpace *ts = (TupleSpace *)swt;
+  int count = 0;
+
+  std::map<unsigned long int, sw_flow*>::iterator i = ts->flows.begin ();
+  while (i != ts->flows.end ())
+    {
+      sw_flow *flow = (i++)->second;
+      if (flow_timeout (flow))
+        {
+          Remove (ts, flow);
+          list_push_back (deleted, &flow->node);
+          count++;
+        }
+    }
+  return count;
+}
+
+void
+TupleSpaceDestroy (sw_table *swt)
+{
+  TupleSpace *ts = (TupleSpace *)swt;
+  for (std::map<unsigned long int, sw_flow*>::iterator i = ts->flows.begin (); i != ts->flows.end (); i++)
+    {
+      flow_free (i->second);
+    }
+  for (std::map<uint32_t, Tuple*>::iterator i = ts->tuples.begin (); i != ts->tuples.end (); i++)
+    {
+      delete i->second;
+    }
+  delete ts;
+}
+
+int
+TupleSpaceIterate (sw_table *swt, const sw_flow_key *key, uint16_t out_port, sw_table_position *position,
+                   int (*callback)(sw_flow *, void *), void *_private)
+{
+  TupleSpace *ts = (TupleSpace *)swt;
+
+  // Newest flows first; the position holds the complement of the serial to resume from.
+  unsigned long int start = ~position->_private[0];
+  std::map<unsigned long int, sw_flow*>::reverse_iterator i (ts->flows.upper_bound (start));
+  for (; i != ts->flows.rend (); i++)
+    {
+      sw_flow *flow = i->second;
+      if (flow_matches_2wild (key, &flow->key) && flow_has_out_port (flow, out_port))
+        {
+          int error = callback (flow, _private);
+          if (error)
+            {
+              position->_private[0] = ~flow->serial;
+              return error;
+            }
+        }
+    }
+  return 0;
+}
+
+void
+TupleSpaceStats (sw_table *swt, sw_table_stats *stats)
+{
+  TupleSpace *ts = (TupleSpace *)swt;
+  stats->name = "tuple-space";
+  stats->wildcards = OFPFW_ALL;
+  stats->n_flows = ts->n_flows;
+  stats->max_flows = ts->max_flows;
+  stats->n_lookup = swt->n_lookup;
+  stats->n_matched = swt->n_matched;
+}
+
+} // anonymous namespace
+
+sw_table*
+TupleSpaceTableCreate (unsigned int max_flows)
+{
+  TupleSpace *ts = new TupleSpace;
+  memset (&ts->swt, 0, sizeof ts->swt);
+  ts->swt.lookup = TupleSpaceLookup;
+  ts->swt.insert = TupleSpaceInsert;
+  ts->swt.modify = TupleSpaceModify;
+  ts->swt._delete = TupleSpaceDelete;
+  ts->swt.timeout = TupleSpaceTimeout;
+  ts->swt.destroy = TupleSpaceDestroy;
+  ts->swt.iterate = TupleSpaceIterate;
+  ts->swt.stats = TupleSpaceStats;
+
+  ts->max_flows = max_flows;
+  ts->n_flows = 0;
+  ts->next_serial = 0;
+  return &ts->swt;
+}
+
+sw_flow*
+TupleSpaceTableFind (sw_table *table, const sw_flow_key *key, uint16_t priority)
+{
+  return FindStrict ((TupleSpace *)table, key, priority);
+}
+
+int
+TupleSpaceTableInstall (sw_chain *chain)
+{
+  if (chain == 0 || chain->n_tables == 0)
+    {
+      return -EINVAL;
+    }
+
+  sw_table *linear = chain->tables[chain->n_tables - 1];
+  sw_table_stats stats;
+  linear->stats (linear, &stats);
+  if (strcmp (stats.name, "linear") != 0 || stats.n_flows != 0)
+    {
+      NS_LOG_WARN ("Last table of the chain is not an empty linear table; keeping it.");
+      return -EINVAL;
+    }
+
+  sw_table *table = TupleSpaceTableCreate (stats.max_flows);
+  if (table == 0)
+    {
+      return -ENOMEM;
+    }
+  linear->destroy (linear);
+  chain->tables[chain->n_tables - 1] = table;
+  return 0;
+}
+
+} // namespace ofi
+
+} // namespace ns3
+
+#endif // NS3_OPENFLOW
@@ -0,0 +1,74 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef OPENFLOW_TUPLE_SPACE_TABLE_H
+#define OPENFLOW_TUPLE_SPACE_TABLE_H
+
+#include "openflow-interface.h"
+
+namespace ns3 {
+
+namespace ofi {
+
+/**
+ * \ingroup openflow
+ * \brief Create a tuple-space-search flow table for wildcarded flows.
+ *
+ * The table plugs into an OFSID sw_chain like the table types shipped
+ * with the library. Flows are grouped by their wildcard mask; each group
+ * (a "tuple") keeps a hash table of the masked flow keys, so a lookup costs
+ * one hash probe per distinct mask instead of one comparison per flow.
+ * Tuples are visited in order of the highest priority they hold, and the
+ * search stops as soon as no remaining tuple can beat the best match found.
+ *
+ * Flows with equal priority are resolved in insertion order, as in the
+ * OFSID linear table this table is meant to replace.
+ *
+ * \param max_flows Maximum number of flows the table accepts.
+ * \return The new table, or 0 if out of memory.
+ */
+sw_table* TupleSpaceTableCreate (unsigned int max_flows);
+
+/**
+ * \ingroup openflow
+ * \brief Find the flow of a tuple-space table that a strict delete would remove.
+ *
+ * Only the one hash bucket the match falls in is searched.
+ *
+ * \param table A table made by TupleSpaceTableCreate.
+ * \param key The match, wildcards included.
+ * \param priority The priority.
+ * \return The flow with exactly this match and priority, or 0 if there is none.
+ */
+sw_flow* TupleSpaceTableFind (sw_table *table, const sw_flow_key *key, uint16_t priority);
+
+/**
+ * \ingroup openflow
+ * \brief Replace the linear table of an OFSID chain by a tuple-space table.
+ *
+ * chain_create () ends the chain with a linear table that takes every
+ * wildcarded flow. It must still be empty; it is destroyed and a tuple-space
+ * table with the same capacity takes its place.
+ *
+ * \param chain The flow table chain.
+ * \return 0 if everything's ok, otherwise an error number.
+ */
+int TupleSpaceTableInstall (sw_chain *chain);
+
+} // namespace ofi
+
+} // namespace ns3
+
+#endif /* OPENFLOW_TUPLE_SPACE_TABLE_H */
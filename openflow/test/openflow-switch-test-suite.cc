@@ -21,14 +21,207 @@
 
 // An essential include is test.h
 #include "ns3/test.h"
+#include "ns3/boolean.h"
+#include "ns3/double.h"
+#include "ns3/enum.h"
+#include "ns3/pointer.h"
+#include "ns3/uinteger.h"
 
 #include "ns3/openflow-switch-net-device.h"
 #include "ns3/openflow-interface.h"
+#include "ns3/openflow-tuple-space-table.h"
+#include "ns3/openflow-flow-timer-wheel.h"
+#include "ns3/openflow-control-link.h"
+#include "ns3/simulator.h"
+#include "ns3/node.h"
+#include "ns3/arp-header.h"
+#include "ns3/ipv4-address.h"
+#include "ns3/simple-net-device.h"
+#include "ns3/simple-channel.h"
+
+#include <algorithm>
 
 // Do not put your test classes in namespace ns3.  You may find it useful
 // to use the using directive to access the ns3 namespace directly
 using namespace ns3;
 
+/// Switch port recording the frames sent out of it, with a link that can be cut.
+class TestPortDevice : public SimpleNetDevice
+{
+public:
+  TestPortDevice () : m_up (true)
+  {
+  }
+
+  /// Bring the link up or down, telling whoever listens.
+  void SetLinkUp (bool up)
+  {
+    m_up = up;
+    m_linkChange ();
+  }
+
+  virtual bool IsLinkUp (void) const
+  {
+    return m_up;
+  }
+
+  virtual void AddLinkChangeCallback (Callback<void> callback)
+  {
+    m_linkChange.ConnectWithoutContext (callback);
+  }
+
+  virtual bool SendFrom (Ptr<Packet> packet, const Address& source, const Address& dest, uint16_t protocolNumber)
+  {
+    m_sent.push_back (packet->Copy ());
+    m_protocols.push_back (protocolNumber);
+    m_dests.push_back (Mac48Address::ConvertFrom (dest));
+    m_times.push_back (Simulator::Now ());
+    return true;
+  }
+
+  std::vector<Ptr<Packet> > m_sent;     ///< Frames sent, without their Ethernet header.
+  std::vector<uint16_t> m_protocols;    ///< Protocol of each frame sent.
+  std::vector<Mac48Address> m_dests;    ///< Destination of each frame sent.
+  std::vector<Time> m_times;            ///< When each frame was sent.
+
+private:
+  bool m_up;
+  TracedCallback<> m_linkChange;
+};
+
+/**
+ * Build a switch on its own node, with ports that record what they send.
+ *
+ * \param controller The controller of the switch.
+ * \param n Number of ports.
+ * \param ports Filled with the ports, in switch port order.
+ * \return The switch.
+ */
+static Ptr<OpenFlowSwitchNetDevice>
+CreateTestSwitch (Ptr<ofi::Controller> controller, uint32_t n, std::vector<Ptr<TestPortDevice> >& ports)
+{
+  Ptr<Node> node = CreateObject<Node> ();
+  Ptr<OpenFlowSwitchNetDevice> swtch = CreateObject<OpenFlowSwitchNetDevice> ();
+  node->AddDevice (swtch);
+  swtch->SetController (controller);
+  for (uint32_t i = 0; i < n; i++)
+    {
+      Ptr<TestPortDevice> port = CreateObject<TestPortDevice> ();
+      port->SetAddress (Mac48Address::Allocate ());
+      port->SetChannel (CreateObject<SimpleChannel> ());
+      node->AddDevice (port);
+      swtch->AddSwitchPort (port);
+      ports.push_back (port);
+    }
+  return swtch;
+}
+
+/**
+ * A switch with ports that record what they send, and its controller, as the
+ * cases running a switch set them up. The simulation and both objects are
+ * torn down when it goes out of scope.
+ */
+class TestNetwork
+{
+public:
+  /**
+   * \param controller The controller of the switch.
+   * \param n Number of ports.
+   * \param controlDelay One-way delay of the control connection.
+   */
+  TestNetwork (Ptr<ofi::Controller> controller, uint32_t n, Time controlDelay = Seconds (0))
+    : controller (controller)
+  {
+    swtch = CreateTestSwitch (controller, n, ports);
+    swtch->SetAttribute ("ControlDelay", TimeValue (controlDelay));
+  }
+
+  ~TestNetwork ()
+  {
+    Simulator::Destroy ();
+    swtch->Dispose ();
+    controller->Dispose ();
+  }
+
+  /**
+   * Register the switch with its controller, host i attached to port i, and
+   * have the controller compute its routes.
+   *
+   * \param hosts Addresses of the hosts.
+   * \param n Number of hosts.
+   */
+  void AddHosts (const Mac48Address *hosts, uint32_t n)
+  {
+    std::map<uint32_t, Mac48Address> switchlist, nodelist;
+    for (uint32_t i = 0; i < n; i++)
+      {
+        nodelist[i] = hosts[i];
+      }
+    controller->create_path (Mac48Address::ConvertFrom (swtch->GetAddress ()), switchlist, nodelist, 0);
+    controller->FinalizeTopology ();
+  }
+
+  /**
+   * Hand the switch a 64 byte IPv4 frame from a host.
+   *
+   * \param port Port the frame comes in over.
+   * \param src Source address.
+   * \param dst Destination address.
+   */
+  void Receive (uint32_t port, Mac48Address src, Mac48Address dst)
+  {
+    ports[port]->Receive (Create<Packet> (64), 0x0800, dst, src);
+  }
+
+  Ptr<ofi::Controller> controller;          ///< The controller.
+  Ptr<OpenFlowSwitchNetDevice> swtch;       ///< The switch.
+  std::vector<Ptr<TestPortDevice> > ports;  ///< Ports of the switch, in switch port order.
+};
+
+/// Flow mod adding a flow that outputs every packet to an address on one port.
+class OutputFlow
+{
+public:
+  /**
+   * \param dst The destination address matched.
+   * \param port The output port.
+   */
+  OutputFlow (Mac48Address dst, uint16_t port)
+  {
+    action.type = htons (OFPAT_OUTPUT);
+    action.len = htons (sizeof(ofp_action_output));
+    action.port = port;
+    action.max_len = 0;
+
+    flow match;
+    memset (&match, 0, sizeof match);
+    dst.CopyTo (match.dl_dst);
+    spec.SetMatch (match, OFPFW_ALL & ~OFPFW_DL_DST);
+    spec.actions = (ofp_action_header*)&action;
+    spec.actions_len = sizeof(action);
+  }
+
+  ofp_action_output action;  ///< The output action; spec points at it.
+  ofi::FlowSpec spec;        ///< The flow mod.
+
+private:
+  OutputFlow (const OutputFlow&);
+  OutputFlow& operator= (const OutputFlow&);
+};
+
+/**
+ * \param dst Destination address.
+ * \return The exact-match key of a packet to the address, with every other field 0.
+ */
+static sw_flow_key
+DestinationKey (Mac48Address dst)
+{
+  sw_flow_key key;
+  memset (&key, 0, sizeof key);
+  dst.CopyTo (key.flow.dl_dst);
+  return key;
+}
+
 // This is an example TestCase.
 class SwitchFlowTableTestCase : public TestCase
 {
@@ -173,6 +366,1437 @@ SwitchFlowTableTestCase::DoRun (void)
   NS_TEST_ASSERT_MSG_EQ (chain_lookup (m_chain, &key), 0, "Key provided shouldn't match the flow but it does.");
 }
 
+// Wildcarded flows are held by the tuple-space table at the end of the switch's chain.
+class TupleSpaceTableTestCase : public TestCase
+{
+public:
+  TupleSpaceTableTestCase () : TestCase ("Tuple-space table test case")
+  {
+    m_chain = chain_create ();
+  }
+
+  virtual ~TupleSpaceTableTestCase ()
+  {
+    chain_destroy (m_chain);
+  }
+
+private:
+  virtual void DoRun (void);
+
+  /**
+   * Build a flow matching only the given destination MAC and, if tp_dst is not 0, TCP/UDP destination port.
+   */
+  sw_flow* MakeFlow (Mac48Address dl_dst, uint16_t tp_dst, uint16_t priority);
+
+  sw_chain* m_chain;
+};
+
+sw_flow*
+TupleSpaceTableTestCase::MakeFlow (Mac48Address dl_dst, uint16_t tp_dst, uint16_t priority)
+{
+  sw_flow *flow = flow_alloc (0);
+  memset (&flow->key, 0, sizeof flow->key);
+  flow->key.wildcards = OFPFW_ALL & ~OFPFW_DL_DST;
+  dl_dst.CopyTo (flow->key.flow.dl_dst);
+  if (tp_dst != 0)
+    {
+      flow->key.wildcards &= ~OFPFW_TP_DST;
+      flow->key.flow.tp_dst = htons (tp_dst);
+    }
+  flow->priority = priority;
+  flow->idle_timeout = OFP_FLOW_PERMANENT;
+  flow->hard_timeout = OFP_FLOW_PERMANENT;
+  flow->used = flow->created = time_now ();
+  flow->sf_acts->actions_len = 0;
+  flow->byte_count = 0;
+  flow->packet_count = 0;
+  return flow;
+}
+
+void
+TupleSpaceTableTestCase::DoRun (void)
+{
+  time_init ();
+  NS_TEST_ASSERT_MSG_EQ (ofi::TupleSpaceTableInstall (m_chain), 0, "Failed to install the tuple-space table.");
+
+  sw_table *table = m_chain->tables[m_chain->n_tables - 1];
+  sw_table_stats stats;
+  table->stats (table, &stats);
+  NS_TEST_ASSERT_MSG_EQ (std::string (stats.name), "tuple-space", "Last table of the chain is not the tuple-space table.");
+
+  Mac48Address dst ("00:00:00:00:00:01"), other ("00:00:00:00:00:02");
+  sw_flow *coarse = MakeFlow (dst, 0, 100);
+  sw_flow *fine = MakeFlow (dst, 80, 200);
+  NS_TEST_ASSERT_MSG_EQ (chain_insert (m_chain, coarse), 0, "Flow table failed to insert the coarse Flow.");
+  NS_TEST_ASSERT_MSG_EQ (chain_insert (m_chain, fine), 0, "Flow table failed to insert the fine Flow.");
+
+  // Exact-match key as extracted from a packet.
+  sw_flow_key key;
+  memset (&key, 0, sizeof key);
+  key.flow.dl_type = htons (ETH_TYPE_IP);
+  key.flow.nw_proto = IP_TYPE_TCP;
+  dst.CopyTo (key.flow.dl_dst);
+  key.flow.tp_dst = htons (80);
+  NS_TEST_ASSERT_MSG_EQ (chain_lookup (m_chain, &key), fine, "Higher priority Flow should win.");
+
+  key.flow.tp_dst = htons (22);
+  NS_TEST_ASSERT_MSG_EQ (chain_lookup (m_chain, &key), coarse, "Only the coarse Flow covers this key.");
+
+  other.CopyTo (key.flow.dl_dst);
+  NS_TEST_ASSERT_MSG_EQ (chain_lookup (m_chain, &key), 0, "No Flow covers this key.");
+
+  table->stats (table, &stats);
+  NS_TEST_ASSERT_MSG_EQ (stats.n_flows, 2u, "Table stats report the wrong number of flows.");
+
+  // Strict delete of the fine Flow leaves the coarse one in charge.
+  sw_flow_key fine_key = fine->key; // The flow itself is freed by the delete.
+  dst.CopyTo (key.flow.dl_dst);
+  key.flow.tp_dst = htons (80);
+  NS_TEST_ASSERT_MSG_EQ (chain_delete (m_chain, &fine_key, OFPP_NONE, 200, 1), 1, "Flow table failed to delete the fine Flow.");
+  NS_TEST_ASSERT_MSG_EQ (chain_lookup (m_chain, &key), coarse, "Coarse Flow should match once the fine one is gone.");
+
+  // A full table turns a flow away without leaving anything of it behind, so
+  // removing the top flow of the tuple only finds the ones that went in.
+  Mac48Address third ("00:00:00:00:00:03");
+  sw_table *full = ofi::TupleSpaceTableCreate (2);
+  sw_flow *top = MakeFlow (dst, 0, 200);
+  sw_flow *low = MakeFlow (other, 0, 100);
+  sw_flow *refused = MakeFlow (third, 0, 100);
+  NS_TEST_ASSERT_MSG_EQ (full->insert (full, top), 1, "Flow should fit in the table.");
+  NS_TEST_ASSERT_MSG_EQ (full->insert (full, low), 1, "Flow should fit in the table.");
+  NS_TEST_ASSERT_MSG_EQ (full->insert (full, refused), 0, "Flow should not fit in a full table.");
+  flow_free (refused);
+  sw_flow_key top_key = top->key;
+  NS_TEST_ASSERT_MSG_EQ (full->_delete (full, &top_key, OFPP_NONE, 200, 1), 1, "Top Flow should be deleted.");
+  other.CopyTo (key.flow.dl_dst);
+  NS_TEST_ASSERT_MSG_EQ (full->lookup (full, &key), low, "Remaining Flow should still match.");
+  third.CopyTo (key.flow.dl_dst);
+  NS_TEST_ASSERT_MSG_EQ (full->lookup (full, &key), 0, "Refused Flow should not be found.");
+  full->destroy (full);
+}
+
+// Action lists are compiled once per flow and executed from the compiled form.
+class ActionProgramTestCase : public TestCase
+{
+public:
+  ActionProgramTestCase () : TestCase ("Action program test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+ActionProgramTestCase::DoRun (void)
+{
+  // Set the source MAC, then output on port 2.
+  uint8_t actions[sizeof (ofp_action_dl_addr) + sizeof (ofp_action_output)];
+  memset (actions, 0, sizeof actions);
+  ofp_action_dl_addr *ad = (ofp_action_dl_addr*)actions;
+  ad->type = htons (OFPAT_SET_DL_SRC);
+  ad->len = htons (sizeof (ofp_action_dl_addr));
+  ofp_action_output *oa = (ofp_action_output*)(actions + sizeof (ofp_action_dl_addr));
+  oa->type = htons (OFPAT_OUTPUT);
+  oa->len = htons (sizeof (ofp_action_output));
+  oa->port = 2;
+  oa->max_len = htons (64);
+
+  ofi::ActionProgram program;
+  ofi::CompileActions ((ofp_action_header*)actions, sizeof actions, program);
+  NS_TEST_ASSERT_MSG_EQ (program.ops.size (), 2u, "Each action should compile to one op.");
+  NS_TEST_ASSERT_MSG_EQ (program.ops[0].kind, ofi::ActionProgram::Op::ACTION, "First op should set a field.");
+  NS_TEST_ASSERT_MSG_EQ (program.ops[0].type, OFPAT_SET_DL_SRC, "Action type should be decoded to host order.");
+  NS_TEST_ASSERT_MSG_EQ (program.ops[1].kind, ofi::ActionProgram::Op::OUTPUT, "Second op should output.");
+  NS_TEST_ASSERT_MSG_EQ (program.ops[1].port, 2, "Output port should be resolved.");
+  NS_TEST_ASSERT_MSG_EQ (program.ops[1].max_len, 64u, "Output max_len should be decoded to host order.");
+  NS_TEST_ASSERT_MSG_EQ (program.rewrites, true, "Setting a field rewrites the packet.");
+  NS_TEST_ASSERT_MSG_EQ (program.CompiledFrom ((ofp_action_header*)actions, sizeof actions), true, "Program should match its action list.");
+
+  oa->port = 3;
+  NS_TEST_ASSERT_MSG_EQ (program.CompiledFrom ((ofp_action_header*)actions, sizeof actions), false, "Program shouldn't match a changed action list.");
+}
+
+class FlowTimerWheelTestCase : public TestCase
+{
+public:
+  FlowTimerWheelTestCase () : TestCase ("Flow timer wheel test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+FlowTimerWheelTestCase::DoRun (void)
+{
+  // The wheel never touches the flows, so any distinct pointers will do.
+  sw_flow flows[3];
+  ofi::FlowTimerWheel wheel;
+  std::vector<ofi::FlowTimerWheel::Timer> due;
+
+  // One timer on each of the first three levels.
+  wheel.Schedule (5000, &flows[2], 3);
+  wheel.Schedule (70, &flows[1], 2);
+  wheel.Schedule (3, &flows[0], 1);
+  NS_TEST_ASSERT_MSG_EQ (wheel.GetSize (), 3u, "Wheel should hold three timers.");
+  NS_TEST_ASSERT_MSG_EQ (wheel.GetNextTick (), 3u, "Nearest timer should be due at tick 3.");
+
+  wheel.Advance (2, due);
+  NS_TEST_ASSERT_MSG_EQ (due.size (), 0u, "No timer should fire before its tick.");
+
+  wheel.Advance (3, due);
+  NS_TEST_ASSERT_MSG_EQ (due.size (), 1u, "One timer should fire at tick 3.");
+  NS_TEST_ASSERT_MSG_EQ (due[0].flow, &flows[0], "Timer at tick 3 should fire first.");
+  NS_TEST_ASSERT_MSG_EQ (due[0].serial, 1u, "Timer should keep its serial.");
+
+  due.clear ();
+  wheel.Advance (69, due);
+  NS_TEST_ASSERT_MSG_EQ (due.size (), 0u, "Level 1 timer shouldn't fire early.");
+  wheel.Advance (70, due);
+  NS_TEST_ASSERT_MSG_EQ (due.size (), 1u, "Level 1 timer should fire at its tick.");
+  NS_TEST_ASSERT_MSG_EQ (due[0].flow, &flows[1], "Timer at tick 70 should fire second.");
+
+  uint64_t next = wheel.GetNextTick ();
+  NS_TEST_ASSERT_MSG_GT (next, 70u, "Next tick should be in the future.");
+  NS_TEST_ASSERT_MSG_LT (next, 5001u, "Next tick shouldn't skip the last timer.");
+
+  due.clear ();
+  wheel.Advance (4999, due);
+  NS_TEST_ASSERT_MSG_EQ (due.size (), 0u, "Level 2 timer shouldn't fire early.");
+  wheel.Advance (6000, due);
+  NS_TEST_ASSERT_MSG_EQ (due.size (), 1u, "Level 2 timer should fire once its tick passes.");
+  NS_TEST_ASSERT_MSG_EQ (due[0].expires, 5000u, "Timer should fire for tick 5000.");
+  NS_TEST_ASSERT_MSG_EQ (wheel.GetSize (), 0u, "Wheel should be empty.");
+  NS_TEST_ASSERT_MSG_EQ (wheel.GetNextTick (), 0u, "Empty wheel has no next tick.");
+
+  // A timer that is already due fires on the next tick.
+  due.clear ();
+  wheel.Schedule (10, &flows[0], 4);
+  wheel.Advance (6001, due);
+  NS_TEST_ASSERT_MSG_EQ (due.size (), 1u, "Overdue timer should fire on the next tick.");
+}
+
+class ControlLinkTestCase : public TestCase
+{
+public:
+  ControlLinkTestCase () : TestCase ("Control link test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+
+  /// Record a delivered message.
+  void Deliver (const uint8_t *msg, size_t length)
+  {
+    m_arrivals.push_back (Simulator::Now ());
+    m_lengths.push_back (length);
+  }
+
+  std::vector<Time> m_arrivals;
+  std::vector<size_t> m_lengths;
+};
+
+void
+ControlLinkTestCase::DoRun (void)
+{
+  // 100 byte messages take 100 ms to send at 8 kbps, then 10 ms to propagate.
+  uint8_t msg[100];
+  memset (msg, 0, sizeof msg);
+  ofi::ControlLink link;
+  link.SetDeliverCallback (MakeCallback (&ControlLinkTestCase::Deliver, this));
+  link.SetDelay (MilliSeconds (10));
+  link.SetDataRate (DataRate ("8kbps"));
+  link.SetMaxMessages (2);
+  NS_TEST_ASSERT_MSG_EQ (link.IsInstant (), false, "Link with a delay isn't instant.");
+
+  NS_TEST_ASSERT_MSG_EQ (link.Send (msg, sizeof msg), true, "First message should be sent.");
+  NS_TEST_ASSERT_MSG_EQ (link.Send (msg, 50), true, "Second message should be queued.");
+  NS_TEST_ASSERT_MSG_EQ (link.Send (msg, sizeof msg), false, "Third message should find the queue full.");
+  Simulator::Run ();
+  Simulator::Destroy ();
+
+  NS_TEST_ASSERT_MSG_EQ (m_arrivals.size (), 2u, "Two messages should arrive.");
+  if (m_arrivals.size () == 2)
+    {
+      NS_TEST_ASSERT_MSG_EQ (m_arrivals[0], MilliSeconds (110), "First message should arrive after its transmission and propagation.");
+      NS_TEST_ASSERT_MSG_EQ (m_arrivals[1], MilliSeconds (160), "Second message should be sent after the first.");
+      NS_TEST_ASSERT_MSG_EQ (m_lengths[1], 50u, "Message should arrive whole.");
+    }
+  NS_TEST_ASSERT_MSG_EQ (link.GetDelivered (), 2u, "Delivered messages should be counted.");
+  NS_TEST_ASSERT_MSG_EQ (link.GetDrops (), 1u, "Dropped message should be counted.");
+  NS_TEST_ASSERT_MSG_EQ (link.GetQueueingDelay (), MilliSeconds (100), "Second message should have waited for the first.");
+}
+
+/// Controller recording the messages it gets done with.
+class RecordingController : public ofi::Controller
+{
+public:
+  virtual void ReceiveFromSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer)
+  {
+    m_types.push_back (GetPacketType (buffer));
+    m_times.push_back (Simulator::Now ());
+    if (GetPacketType (buffer) == OFPT_PACKET_IN)
+      {
+        m_bufferIds.push_back (ntohl (((ofp_packet_in*)buffer->data)->buffer_id));
+      }
+    else if (GetPacketType (buffer) == OFPT_STATS_REPLY)
+      {
+        const uint8_t *data = (const uint8_t*)buffer->data;
+        m_statsReplies.push_back (std::vector<uint8_t> (data + offsetof (ofp_stats_reply, body), data + buffer->size));
+      }
+  }
+
+  /**
+   * Sends a switch a statistics request.
+   *
+   * \param swtch The switch.
+   * \param type The OFPST_* statistics type.
+   * \param body The request body.
+   * \param body_len Length of the body.
+   */
+  void RequestStats (Ptr<OpenFlowSwitchNetDevice> swtch, uint16_t type, const void *body, size_t body_len)
+  {
+    std::vector<uint8_t> msg (offsetof (ofp_stats_request, body) + body_len);
+    ofp_stats_request *rq = (ofp_stats_request*)&msg[0];
+    rq->header.version = OFP_VERSION;
+    rq->header.type = OFPT_STATS_REQUEST;
+    rq->header.length = htons (msg.size ());
+    rq->type = htons (type);
+    memcpy (rq->body, body, body_len);
+    SendToSwitch (swtch, &msg[0], msg.size ());
+  }
+
+  virtual void PortStatusChanged (Ptr<OpenFlowSwitchNetDevice> swtch, const ofp_port_status *ops)
+  {
+    m_portStatus.push_back (ntohs (ops->desc.port_no));
+  }
+
+  std::vector<uint8_t> m_types;
+  std::vector<Time> m_times;
+  std::vector<uint32_t> m_bufferIds;   ///< Buffer ids of the packet ins.
+  std::vector<uint16_t> m_portStatus;  ///< Ports of the port status messages.
+  std::vector<std::vector<uint8_t> > m_statsReplies; ///< Bodies of the stats replies.
+};
+
+class ControllerQueueTestCase : public TestCase
+{
+public:
+  ControllerQueueTestCase () : TestCase ("Controller queue test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+
+  /// Hand the controller a message with no body.
+  void Enqueue (Ptr<ofi::Controller> controller, uint8_t type)
+  {
+    ofp_header oh;
+    memset (&oh, 0, sizeof oh);
+    oh.version = OFP_VERSION;
+    oh.type = type;
+    oh.length = htons (sizeof oh);
+    ofpbuf *buffer = ofpbuf_new (sizeof oh);
+    ofpbuf_put (buffer, &oh, sizeof oh);
+    controller->EnqueueFromSwitch (0, buffer);
+    ofpbuf_delete (buffer);
+  }
+};
+
+void
+ControllerQueueTestCase::DoRun (void)
+{
+  // Every message takes 10 ms; two can wait while another is processed.
+  Ptr<ConstantRandomVariable> time = CreateObject<ConstantRandomVariable> ();
+  time->SetAttribute ("Constant", DoubleValue (0.01));
+  Ptr<RecordingController> controller = CreateObject<RecordingController> ();
+  controller->SetAttribute ("ProcessingTime", PointerValue (time));
+  controller->SetAttribute ("QueueSize", UintegerValue (2));
+  controller->SetAttribute ("QueueDiscipline", EnumValue (ofi::Controller::PRIORITY));
+
+  // A miss storm, then a port status that has to get through.
+  Enqueue (controller, OFPT_PACKET_IN);
+  Enqueue (controller, OFPT_PACKET_IN);
+  Enqueue (controller, OFPT_PACKET_IN);
+  NS_TEST_ASSERT_MSG_EQ (controller->GetQueueLength (), 2u, "Two packet ins should wait behind the first.");
+  Enqueue (controller, OFPT_PORT_STATUS);
+  NS_TEST_ASSERT_MSG_EQ (controller->GetQueueDrops (), 1u, "Port status should push out a packet in.");
+  Simulator::Run ();
+  Simulator::Destroy ();
+
+  NS_TEST_ASSERT_MSG_EQ (controller->m_types.size (), 3u, "Three messages should be processed.");
+  if (controller->m_types.size () == 3)
+    {
+      NS_TEST_ASSERT_MSG_EQ ((int)controller->m_types[1], OFPT_PORT_STATUS, "Port status should go ahead of waiting packet ins.");
+      NS_TEST_ASSERT_MSG_EQ (controller->m_times[0], MilliSeconds (10), "First message should be done after its processing time.");
+      NS_TEST_ASSERT_MSG_EQ (controller->m_times[2], MilliSeconds (30), "Messages should be processed one at a time.");
+    }
+  controller->Dispose ();
+}
+
+class PortStatusTestCase : public TestCase
+{
+public:
+  PortStatusTestCase () : TestCase ("Port status test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+PortStatusTestCase::DoRun (void)
+{
+  // Any controller hears of a port going down, whether or not it is processing other messages.
+  Ptr<ConstantRandomVariable> time = CreateObject<ConstantRandomVariable> ();
+  time->SetAttribute ("Constant", DoubleValue (0.01));
+  Ptr<RecordingController> controller = CreateObject<RecordingController> ();
+  controller->SetAttribute ("ProcessingTime", PointerValue (time));
+  TestNetwork net (controller, 2);
+  Simulator::Run ();
+  size_t before = controller->m_portStatus.size ();
+  size_t received = controller->m_types.size ();
+
+  net.ports[1]->SetLinkUp (false);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (controller->m_portStatus.size () - before, 1u, "Port status should reach PortStatusChanged.");
+  if (controller->m_portStatus.size () == before + 1)
+    {
+      NS_TEST_ASSERT_MSG_EQ (controller->m_portStatus.back (), 1, "Port status should be for the dead port.");
+    }
+  NS_TEST_ASSERT_MSG_EQ (controller->m_types.size () - received, 1u, "Port status should reach ReceiveFromSwitch too.");
+}
+
+class PendingMissTestCase : public TestCase
+{
+public:
+  PendingMissTestCase () : TestCase ("Pending miss test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+PendingMissTestCase::DoRun (void)
+{
+  Ptr<RecordingController> controller = CreateObject<RecordingController> ();
+  TestNetwork net (controller, 0);
+  Ptr<OpenFlowSwitchNetDevice> swtch = net.swtch;
+  swtch->SetAttribute ("PendingMissQueueSize", UintegerValue (1));
+  swtch->SetAttribute ("PendingMissTimeout", TimeValue (MilliSeconds (5)));
+  size_t before = controller->m_types.size (); // Port status messages, if any.
+
+  // Three packets of one flow the controller never adds a flow for.
+  Mac48Address src ("00:00:00:00:02:00");
+  Mac48Address dst ("00:00:00:00:02:01");
+  for (int i = 0; i < 3; i++)
+    {
+      swtch->SendFrom (Create<Packet> (64), src, dst, 0x0800);
+    }
+  Simulator::Stop (MilliSeconds (1));
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (controller->m_types.size () - before, 2u, "First packet and the one over the bound should reach the controller.");
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetCoalescedMisses (), 1u, "Second packet should be held back.");
+
+  // Once the timeout passes, the held packet goes to the controller after all.
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (controller->m_types.size () - before, 3u, "Held packet should reach the controller on timeout.");
+  if (controller->m_types.size () == before + 3)
+    {
+      NS_TEST_ASSERT_MSG_EQ ((int)controller->m_types.back (), OFPT_PACKET_IN, "Held packet should come as a packet in.");
+    }
+}
+
+class PacketInMeterTestCase : public TestCase
+{
+public:
+  PacketInMeterTestCase () : TestCase ("Packet in meter test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+PacketInMeterTestCase::DoRun (void)
+{
+  // The switch lets two packet ins through at once, the controller admits one.
+  Ptr<RecordingController> controller = CreateObject<RecordingController> ();
+  controller->SetAttribute ("PacketInRate", DoubleValue (1));
+  controller->SetAttribute ("PacketInBurst", UintegerValue (1));
+  TestNetwork net (controller, 0);
+  Ptr<OpenFlowSwitchNetDevice> swtch = net.swtch;
+  swtch->SetAttribute ("PacketInRate", DoubleValue (10));
+  swtch->SetAttribute ("PacketInBurst", UintegerValue (2));
+  size_t before = controller->m_types.size ();
+
+  // Four new flows at once.
+  Mac48Address src ("00:00:00:00:02:00");
+  const char *dst[4] = { "00:00:00:00:02:01", "00:00:00:00:02:02", "00:00:00:00:02:03", "00:00:00:00:02:04" };
+  for (int i = 0; i < 4; i++)
+    {
+      swtch->SendFrom (Create<Packet> (64), src, Mac48Address (dst[i]), 0x0800);
+    }
+  Simulator::Run ();
+
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetPacketIns (), 2u, "Burst should let two packet ins through.");
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetPacketInMeterDrops (), 2u, "Packet ins over the burst should be dropped.");
+  NS_TEST_ASSERT_MSG_EQ (controller->GetAdmissionDrops (), 1u, "Controller should admit one packet in.");
+  NS_TEST_ASSERT_MSG_EQ (controller->m_types.size () - before, 1u, "One packet in should be processed.");
+}
+
+class VendorStatsTestCase : public TestCase
+{
+public:
+  VendorStatsTestCase () : TestCase ("Vendor stats test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+VendorStatsTestCase::DoRun (void)
+{
+  // Two of four misses get through the packet in meter.
+  Ptr<RecordingController> controller = CreateObject<RecordingController> ();
+  TestNetwork net (controller, 0);
+  Ptr<OpenFlowSwitchNetDevice> swtch = net.swtch;
+  swtch->SetAttribute ("PacketInRate", DoubleValue (10));
+  swtch->SetAttribute ("PacketInBurst", UintegerValue (2));
+  Mac48Address src ("00:00:00:00:02:00");
+  const char *dst[4] = { "00:00:00:00:02:01", "00:00:00:00:02:02", "00:00:00:00:02:03", "00:00:00:00:02:04" };
+  for (int i = 0; i < 4; i++)
+    {
+      swtch->SendFrom (Create<Packet> (64), src, Mac48Address (dst[i]), 0x0800);
+    }
+  Simulator::Run ();
+
+  uint32_t vendor = htonl (OFI_VENDOR_ID);
+  controller->RequestStats (swtch, OFPST_VENDOR, &vendor, sizeof vendor);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (controller->m_statsReplies.size (), 1u, "Switch should reply to the request.");
+  if (controller->m_statsReplies.size () == 1)
+    {
+      const std::vector<uint8_t>& body = controller->m_statsReplies[0];
+      NS_TEST_ASSERT_MSG_EQ (body.size (), sizeof(ofi::ofi_packet_in_stats), "Reply should hold the packet in stats.");
+      ofi::ofi_packet_in_stats stats;
+      memset (&stats, 0, sizeof stats);
+      memcpy (&stats, &body[0], std::min (body.size (), sizeof stats));
+      NS_TEST_ASSERT_MSG_EQ (ntohl (stats.vendor), OFI_VENDOR_ID, "Reply should carry the vendor ID.");
+      NS_TEST_ASSERT_MSG_EQ (ntohll (stats.packet_in_count), 2u, "Reply should count the packet ins sent.");
+      NS_TEST_ASSERT_MSG_EQ (ntohll (stats.meter_drop_count), 2u, "Reply should count the packet ins the meter refused.");
+    }
+
+  // Another vendor's request isn't answered.
+  vendor = htonl (OFI_VENDOR_ID + 1);
+  controller->RequestStats (swtch, OFPST_VENDOR, &vendor, sizeof vendor);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (controller->m_statsReplies.size (), 1u, "Unknown vendor should get no reply.");
+}
+
+class LearningControllerRouteTestCase : public TestCase
+{
+public:
+  LearningControllerRouteTestCase () : TestCase ("Learning controller route test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+LearningControllerRouteTestCase::DoRun (void)
+{
+  // A ring of four switches; switch i reaches i+1 over port 2 and i-1 over port 3.
+  // Host 0 hangs off switch 0 and host 2 off switch 2, both over port 1.
+  Mac48Address sw[4] = { Mac48Address ("00:00:00:00:01:00"), Mac48Address ("00:00:00:00:01:01"),
+                         Mac48Address ("00:00:00:00:01:02"), Mac48Address ("00:00:00:00:01:03") };
+  Mac48Address host0 ("00:00:00:00:02:00");
+  Mac48Address host2 ("00:00:00:00:02:02");
+
+  Ptr<ofi::LearningController> learning = CreateObject<ofi::LearningController> ();
+  Ptr<ofi::Controller> controller = learning;
+  for (int i = 0; i < 4; i++)
+    {
+      std::map<uint32_t, Mac48Address> switchlist, nodelist;
+      switchlist[2] = sw[(i + 1) % 4];
+      switchlist[3] = sw[(i + 3) % 4];
+      if (i == 0)
+        {
+          nodelist[1] = host0;
+        }
+      else if (i == 2)
+        {
+          nodelist[1] = host2;
+        }
+      controller->create_path (sw[i], switchlist, nodelist, i == 1 ? 1 : 0);
+    }
+
+  uint32_t port = 0;
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupRoute (sw[2], host2, false, &port), true, "Attached host should be routed.");
+  NS_TEST_ASSERT_MSG_EQ (port, 1u, "Attached host should be reached over its own port.");
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupRoute (sw[1], host2, false, &port), true, "Remote host should be routed.");
+  NS_TEST_ASSERT_MSG_EQ (port, 2u, "Switch 1 should reach host 2 through switch 2.");
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupRoute (sw[3], host0, false, &port), true, "Remote host should be routed.");
+  NS_TEST_ASSERT_MSG_EQ (port, 2u, "Switch 3 should reach host 0 through switch 0.");
+
+  // Slow flows avoid the high traffic switch 1.
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupRoute (sw[0], host2, true, &port), true, "Slow plane should route around switch 1.");
+  NS_TEST_ASSERT_MSG_EQ (port, 3u, "Switch 0 should reach host 2 through switch 3 on the slow plane.");
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupRoute (sw[1], host2, true, &port), false, "High traffic switch has no slow routes.");
+
+  // Switch 0 is two hops from host 2 both ways round the ring; the slow plane only has one way.
+  std::vector<uint16_t> ports;
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupEqualCostRoutes (sw[0], host2, false, &ports), 2u, "Both ways round the ring should be kept.");
+  NS_TEST_ASSERT_MSG_EQ (ports.size () == 2 && ports[0] + ports[1] == 5, true, "Switch 0 should reach host 2 through switches 1 and 3.");
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupEqualCostRoutes (sw[0], host2, true, &ports), 1u, "Slow plane should have a single route.");
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupEqualCostRoutes (sw[1], host2, false, &ports), 1u, "Neighbour switch should have a single route.");
+
+  // Hang a fifth switch with enough hosts to grow the routing tables off switch 3.
+  Mac48Address sw4 ("00:00:00:00:01:04");
+  std::map<uint32_t, Mac48Address> switchlist, nodelist;
+  switchlist[2] = sw[0];
+  switchlist[3] = sw[2];
+  switchlist[4] = sw4;
+  controller->create_path (sw[3], switchlist, nodelist, 0);
+  switchlist.clear ();
+  switchlist[1] = sw[3];
+  for (uint8_t i = 0; i < 40; i++)
+    {
+      uint8_t mac[6] = { 0, 0, 0, 0, 3, i };
+      Mac48Address host;
+      host.CopyFrom (mac);
+      nodelist[2 + i] = host;
+    }
+  controller->create_path (sw4, switchlist, nodelist, 0);
+  controller->FinalizeTopology ();
+
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupRoute (sw[0], nodelist[41], false, &port), true, "Hosts of the new switch should be routed.");
+  NS_TEST_ASSERT_MSG_EQ (port, 3u, "Switch 0 should reach the new switch through switch 3.");
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupRoute (sw4, host2, false, &port), true, "New switch should reach the old hosts.");
+  NS_TEST_ASSERT_MSG_EQ (port, 1u, "New switch should reach host 2 through switch 3.");
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupRoute (sw[1], host2, false, &port), true, "Old routes should survive the tables growing.");
+  NS_TEST_ASSERT_MSG_EQ (port, 2u, "Switch 1 should still reach host 2 through switch 2.");
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupEqualCostRoutes (sw[0], host2, false, &ports), 2u, "Equal cost routes should survive the tables growing.");
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupEqualCostRoutes (sw[1], nodelist[41], false, &ports), 2u, "Hosts behind one switch should all get its equal cost routes.");
+  NS_TEST_ASSERT_MSG_EQ (learning->LookupEqualCostRoutes (sw[1], nodelist[2], false, &ports), 2u, "Hosts behind one switch should all get its equal cost routes.");
+}
+
+class ProactiveRoutesTestCase : public TestCase
+{
+public:
+  ProactiveRoutesTestCase () : TestCase ("Proactive routes test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+ProactiveRoutesTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  Ptr<ofi::LearningController> controller = CreateObject<ofi::LearningController> ();
+  controller->SetAttribute ("Proactive", BooleanValue (true));
+  controller->SetAttribute ("ProxyArp", BooleanValue (true));
+  // The flow mods go over the wire and take a while to cross the control connection.
+  TestNetwork net (controller, 2, MilliSeconds (1));
+  net.AddHosts (hosts, 2);
+
+  sw_flow_key pending = DestinationKey (hosts[0]);
+  NS_TEST_ASSERT_MSG_EQ (chain_lookup (net.swtch->GetChain (), &pending), 0, "Flows should still be on their way.");
+  Simulator::Run ();
+
+  for (int i = 0; i < 2; i++)
+    {
+      // Any packet to the host should hit the flow, whatever its other fields.
+      sw_flow_key key = DestinationKey (hosts[i]);
+      key.flow.in_port = htons (7);
+      key.flow.dl_type = htons (ETH_TYPE_IP);
+      key.flow.tp_src = htons (1234 + i);
+
+      sw_flow *flow = chain_lookup (net.swtch->GetChain (), &key);
+      NS_TEST_ASSERT_MSG_NE (flow, 0, "Switch should hold a flow for every host.");
+      if (flow != 0)
+        {
+          ofp_action_output *oa = (ofp_action_output*)flow->sf_acts->actions;
+          NS_TEST_ASSERT_MSG_EQ (oa->port, i, "Flow should output on the port of the host.");
+        }
+    }
+
+  // Broadcasts go out on both host ports; the switch has no tree links.
+  sw_flow_key key = DestinationKey (Mac48Address::GetBroadcast ());
+  sw_flow *flow = chain_lookup (net.swtch->GetChain (), &key);
+  NS_TEST_ASSERT_MSG_NE (flow, 0, "Switch should hold a flood flow.");
+  if (flow != 0)
+    {
+      NS_TEST_ASSERT_MSG_EQ (flow->sf_acts->actions_len, 2 * sizeof (ofp_action_output), "Flood flow should output on every host port.");
+    }
+
+  // ARP requests skip the flood flow and go to the controller, which answers them.
+  key.flow.dl_type = htons (ETH_TYPE_ARP);
+  flow = chain_lookup (net.swtch->GetChain (), &key);
+  NS_TEST_ASSERT_MSG_NE (flow, 0, "Switch should hold a flow for ARP requests.");
+  if (flow != 0)
+    {
+      ofp_action_output *oa = (ofp_action_output*)flow->sf_acts->actions;
+      NS_TEST_ASSERT_MSG_EQ (oa->port, OFPP_CONTROLLER, "ARP requests should be sent to the controller.");
+    }
+}
+
+class ProactivePlanesTestCase : public TestCase
+{
+public:
+  ProactivePlanesTestCase () : TestCase ("Proactive planes test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+ProactivePlanesTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  Ptr<ofi::LearningController> controller = CreateObject<ofi::LearningController> ();
+  controller->SetAttribute ("Proactive", BooleanValue (true));
+  TestNetwork net (controller, 3);
+
+  // The fast route to the second host crosses the busy switch x, over port 1;
+  // the slow one goes around it through y and z, over port 2.
+  Mac48Address s = Mac48Address::ConvertFrom (net.swtch->GetAddress ());
+  Mac48Address x ("00:00:00:00:01:01"), y ("00:00:00:00:01:02"), z ("00:00:00:00:01:03"), t ("00:00:00:00:01:04");
+  std::map<uint32_t, Mac48Address> switchlist, nodelist;
+  Ptr<ofi::Controller> base = controller;
+  switchlist[1] = x;
+  switchlist[2] = y;
+  nodelist[0] = hosts[0];
+  base->create_path (s, switchlist, nodelist, 0);
+  switchlist.clear ();
+  nodelist.clear ();
+  switchlist[0] = s;
+  switchlist[1] = t;
+  base->create_path (x, switchlist, nodelist, 1);
+  switchlist[1] = z;
+  base->create_path (y, switchlist, nodelist, 0);
+  switchlist[0] = y;
+  switchlist[1] = t;
+  base->create_path (z, switchlist, nodelist, 0);
+  switchlist[0] = x;
+  switchlist[1] = z;
+  nodelist[2] = hosts[1];
+  base->create_path (t, switchlist, nodelist, 0);
+  base->FinalizeTopology ();
+  Simulator::Run ();
+
+  // Both planes agree on the first host, so any packet to it hits the flow.
+  sw_flow_key key = DestinationKey (hosts[0]);
+  key.flow.dl_type = htons (ETH_TYPE_IP);
+  key.flow.tp_src = htons (80);
+  NS_TEST_ASSERT_MSG_NE (chain_lookup (net.swtch->GetChain (), &key), 0, "Host both planes agree on should get a flow.");
+
+  // IP packets to the second host have to miss, so slow ones aren't sent the fast way.
+  key = DestinationKey (hosts[1]);
+  key.flow.dl_type = htons (ETH_TYPE_IP);
+  key.flow.tp_src = htons (80);
+  NS_TEST_ASSERT_MSG_EQ (chain_lookup (net.swtch->GetChain (), &key), 0, "IP packets should miss where the planes differ.");
+  key.flow.dl_type = htons (ETH_TYPE_ARP);
+  key.flow.tp_src = 0;
+  sw_flow *flow = chain_lookup (net.swtch->GetChain (), &key);
+  NS_TEST_ASSERT_MSG_NE (flow, 0, "ARP should still get a flow.");
+  if (flow != 0)
+    {
+      NS_TEST_ASSERT_MSG_EQ (((ofp_action_output*)flow->sf_acts->actions)->port, 1, "ARP should take the fast route.");
+    }
+}
+
+class NativeControlTestCase : public TestCase
+{
+public:
+  NativeControlTestCase () : TestCase ("Native control test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+NativeControlTestCase::DoRun (void)
+{
+  Mac48Address dst ("00:00:00:00:02:00");
+  TestNetwork net (CreateObject<RecordingController> (), 0);
+  OutputFlow add (dst, 3);
+  NS_TEST_ASSERT_MSG_EQ (net.swtch->InstallFlow (add.spec), 0, "Flow should be added.");
+
+  sw_flow_key key = DestinationKey (dst);
+  key.flow.dl_type = htons (ETH_TYPE_IP);
+  key.flow.tp_src = htons (80);
+  sw_flow *flow = chain_lookup (net.swtch->GetChain (), &key);
+  NS_TEST_ASSERT_MSG_NE (flow, 0, "Flow should match on its destination alone.");
+  if (flow != 0)
+    {
+      NS_TEST_ASSERT_MSG_EQ (flow->priority, OFP_DEFAULT_PRIORITY, "Flow should keep the default priority.");
+      NS_TEST_ASSERT_MSG_EQ (((ofp_action_output*)flow->sf_acts->actions)->port, 3, "Flow should keep its actions.");
+    }
+
+  // Deleting the flows that output elsewhere leaves it; deleting those on its port doesn't.
+  ofi::FlowSpec del;
+  del.command = OFPFC_DELETE;
+  del.SetMatch (add.spec.key.flow, OFPFW_ALL);
+  del.out_port = 4;
+  net.swtch->InstallFlow (del);
+  NS_TEST_ASSERT_MSG_NE (chain_lookup (net.swtch->GetChain (), &key), 0, "Flow on another port should stay.");
+  del.out_port = 3;
+  NS_TEST_ASSERT_MSG_EQ (net.swtch->InstallFlow (del), 0, "Flow should be deleted.");
+  NS_TEST_ASSERT_MSG_EQ (chain_lookup (net.swtch->GetChain (), &key), 0, "Flow should be gone.");
+}
+
+class LinkDownTestCase : public TestCase
+{
+public:
+  LinkDownTestCase () : TestCase ("Link down test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+LinkDownTestCase::DoRun (void)
+{
+  TestNetwork net (CreateObject<ofi::LearningController> (), 2);
+
+  // One flow out of each port.
+  Mac48Address dst[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  sw_flow_key key[2];
+  for (int i = 0; i < 2; i++)
+    {
+      OutputFlow add (dst[i], i);
+      NS_TEST_ASSERT_MSG_EQ (net.swtch->InstallFlow (add.spec), 0, "Flow should be added.");
+      key[i] = DestinationKey (dst[i]);
+    }
+
+  // The switch reports the dead link; the controller deletes the flows using it over the wire.
+  net.ports[0]->SetLinkUp (false);
+  NS_TEST_ASSERT_MSG_EQ (chain_lookup (net.swtch->GetChain (), &key[0]), 0, "Flow out of the dead port should be flushed.");
+  NS_TEST_ASSERT_MSG_NE (chain_lookup (net.swtch->GetChain (), &key[1]), 0, "Flow out of the live port should stay.");
+}
+
+class AggregatedFlowTestCase : public TestCase
+{
+public:
+  AggregatedFlowTestCase () : TestCase ("Aggregated flow test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+AggregatedFlowTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  Ptr<ofi::LearningController> controller = CreateObject<ofi::LearningController> ();
+  controller->SetAttribute ("AggregateFlows", BooleanValue (true));
+  TestNetwork net (controller, 2, MilliSeconds (1));
+  net.AddHosts (hosts, 2);
+
+  // Both packets miss before the flow arrives: the first comes back with the
+  // flow mod, the second with a packet out.
+  net.Receive (0, hosts[0], hosts[1]);
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 2u, "Both packets should reach the destination port.");
+  sw_flow_key key = DestinationKey (hosts[1]);
+  key.flow.tp_src = htons (1234);
+  NS_TEST_ASSERT_MSG_NE (chain_lookup (net.swtch->GetChain (), &key), 0, "Flow should match on the destination alone.");
+}
+
+class LostFlowTestCase : public TestCase
+{
+public:
+  LostFlowTestCase () : TestCase ("Lost flow test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+LostFlowTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  Ptr<ofi::LearningController> controller = CreateObject<ofi::LearningController> ();
+  controller->SetAttribute ("AggregateFlows", BooleanValue (true));
+  TestNetwork net (controller, 2);
+  net.AddHosts (hosts, 2);
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+
+  // The flow goes missing without the controller hearing of it.
+  OutputFlow del (hosts[1], 1);
+  del.spec.command = OFPFC_DELETE;
+  NS_TEST_ASSERT_MSG_EQ (net.swtch->InstallFlow (del.spec), 0, "Flow should be deleted.");
+  sw_flow_key key = DestinationKey (hosts[1]);
+
+  // The next miss still gets through, and the one after puts the flow back.
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 2u, "Packet should be sent out while the flow is missing.");
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 3u, "Packet should be sent out with the flow.");
+  NS_TEST_ASSERT_MSG_NE (chain_lookup (net.swtch->GetChain (), &key), 0, "Flow should be installed again.");
+}
+
+class FloodFlowTestCase : public TestCase
+{
+public:
+  FloodFlowTestCase () : TestCase ("Flood flow test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+FloodFlowTestCase::DoRun (void)
+{
+  TestNetwork net (CreateObject<ofi::LearningController> (), 3, MilliSeconds (1));
+
+  // A broadcast miss installs the flood flow, which releases the buffered frame.
+  net.Receive (0, Mac48Address ("00:00:00:00:02:00"), Mac48Address::GetBroadcast ());
+  Simulator::Run ();
+
+  NS_TEST_ASSERT_MSG_EQ (net.ports[0]->m_sent.size (), 0u, "The frame should not go back out of its own port.");
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 1u, "The frame should be flooded.");
+  NS_TEST_ASSERT_MSG_EQ (net.ports[2]->m_sent.size (), 1u, "The frame should be flooded.");
+  sw_flow_key key = DestinationKey (Mac48Address::GetBroadcast ());
+  key.flow.in_port = htons (2);
+  NS_TEST_ASSERT_MSG_NE (chain_lookup (net.swtch->GetChain (), &key), 0, "Flood flow should be installed.");
+}
+
+/// Learning controller exposing the routing state it computes.
+class InspectingController : public ofi::LearningController
+{
+public:
+  /**
+   * \param switchid Address of a registered switch.
+   * \return The ports the switch floods broadcasts on.
+   */
+  std::vector<uint16_t> GetFloodPorts (Mac48Address switchid)
+  {
+    UpdateRoutes ();
+    return m_floodTree[m_switchIndex[switchid]];
+  }
+
+  /**
+   * \param switchid Address of a registered switch.
+   * \param dst A host address.
+   * \param key The flow.
+   * \return The fast plane port the switch sends the flow out of.
+   */
+  uint16_t Select (Mac48Address switchid, Mac48Address dst, const sw_flow_key& key)
+  {
+    UpdateRoutes ();
+    return SelectNextHop (FAST, m_switchIndex[switchid], m_addressIndex[dst], key);
+  }
+};
+
+/**
+ * Registers a switch with a host on port 0 and two parallel links to
+ * another switch, over its ports 1 and 2, which reach them over its ports
+ * 0 and 1 and has a host on port 2.
+ *
+ * \param net The switch.
+ * \param x Address of the other switch.
+ * \param hosts The hosts of the switch and of the other switch.
+ */
+static void
+CreateParallelLinks (TestNetwork& net, Mac48Address x, const Mac48Address *hosts)
+{
+  Mac48Address s = Mac48Address::ConvertFrom (net.swtch->GetAddress ());
+  std::map<uint32_t, Mac48Address> switchlist, nodelist;
+  switchlist[1] = x;
+  switchlist[2] = x;
+  nodelist[0] = hosts[0];
+  net.controller->create_path (s, switchlist, nodelist, 0);
+  switchlist.clear ();
+  nodelist.clear ();
+  switchlist[0] = s;
+  switchlist[1] = s;
+  nodelist[2] = hosts[1];
+  net.controller->create_path (x, switchlist, nodelist, 0);
+  net.controller->FinalizeTopology ();
+}
+
+/**
+ * \param swtch A switch.
+ * \return The output ports of the flow broadcasts match in the switch.
+ */
+static std::vector<uint16_t>
+GetBroadcastPorts (Ptr<OpenFlowSwitchNetDevice> swtch)
+{
+  std::vector<uint16_t> ports;
+  sw_flow_key key = DestinationKey (Mac48Address::GetBroadcast ());
+  sw_flow *flow = chain_lookup (swtch->GetChain (), &key);
+  for (size_t i = 0; flow != 0 && i < flow->sf_acts->actions_len / sizeof(ofp_action_output); i++)
+    {
+      ports.push_back (((ofp_action_output*)flow->sf_acts->actions)[i].port);
+    }
+  return ports;
+}
+
+class FloodTreeTestCase : public TestCase
+{
+public:
+  FloodTreeTestCase () : TestCase ("Flood tree test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+FloodTreeTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  Ptr<InspectingController> controller = CreateObject<InspectingController> ();
+  TestNetwork net (controller, 3);
+
+  // Two parallel links to x: ports 1 and 2 here, 0 and 1 there.
+  Mac48Address x ("00:00:00:00:01:01");
+  CreateParallelLinks (net, x, hosts);
+
+  std::vector<uint16_t> ports = controller->GetFloodPorts (x);
+  NS_TEST_ASSERT_MSG_EQ (ports.size (), 2u, "x should flood over one link and to its host.");
+  if (ports.size () == 2)
+    {
+      NS_TEST_ASSERT_MSG_EQ (ports[0], 0, "x should flood back over the tree link.");
+    }
+
+  // The tree moves to the other link, at both ends.
+  net.ports[1]->SetLinkUp (false);
+  Simulator::Run ();
+  ports = controller->GetFloodPorts (x);
+  NS_TEST_ASSERT_MSG_EQ (ports.size (), 2u, "x should still flood over one link and to its host.");
+  if (ports.size () == 2)
+    {
+      NS_TEST_ASSERT_MSG_EQ (ports[0], 1, "x should flood back over the link that is left.");
+    }
+  ports = GetBroadcastPorts (net.swtch);
+  NS_TEST_ASSERT_MSG_EQ (ports.size (), 2u, "Flood flow should be reinstalled.");
+  NS_TEST_ASSERT_MSG_EQ (std::count (ports.begin (), ports.end (), 1), 0, "Flood flow should avoid the dead port.");
+  NS_TEST_ASSERT_MSG_EQ (std::count (ports.begin (), ports.end (), 2), 1, "Flood flow should use the link that is left.");
+
+  net.ports[1]->SetLinkUp (true);
+  Simulator::Run ();
+  ports = GetBroadcastPorts (net.swtch);
+  NS_TEST_ASSERT_MSG_EQ (std::count (ports.begin (), ports.end (), 1), 1, "Flood flow should go back to the first link.");
+  ports = controller->GetFloodPorts (x);
+  NS_TEST_ASSERT_MSG_EQ ((ports.size () == 2 && ports[0] == 0), true, "x should flood over the first link again.");
+}
+
+class EqualCostTestCase : public TestCase
+{
+public:
+  EqualCostTestCase () : TestCase ("Equal cost test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+EqualCostTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  Ptr<InspectingController> controller = CreateObject<InspectingController> ();
+  TestNetwork net (controller, 3);
+  CreateParallelLinks (net, Mac48Address ("00:00:00:00:01:01"), hosts);
+  Mac48Address s = Mac48Address::ConvertFrom (net.swtch->GetAddress ());
+
+  std::vector<uint16_t> ports;
+  NS_TEST_ASSERT_MSG_EQ (controller->LookupEqualCostRoutes (s, hosts[1], false, &ports), 2u, "Both links should lead to the host.");
+
+  // Flows differing only in their source port are spread over both links, each always on the same one.
+  uint32_t count[3] = { 0, 0, 0 };
+  for (uint16_t i = 0; i < 64; i++)
+    {
+      sw_flow_key key = DestinationKey (hosts[1]);
+      key.flow.nw_src = htonl (0x0a010101);
+      key.flow.nw_dst = htonl (0x0a010102);
+      key.flow.nw_proto = 6;
+      key.flow.tp_src = htons (49152 + i);
+      key.flow.tp_dst = htons (80);
+      uint16_t port = controller->Select (s, hosts[1], key);
+      NS_TEST_ASSERT_MSG_EQ ((port == 1 || port == 2), true, "Flow should take one of the links.");
+      NS_TEST_ASSERT_MSG_EQ (controller->Select (s, hosts[1], key), port, "Flow should keep its link.");
+      count[port < 3 ? port : 0]++;
+    }
+  NS_TEST_ASSERT_MSG_GT (count[1], 16u, "Flows should be spread over the first link.");
+  NS_TEST_ASSERT_MSG_GT (count[2], 16u, "Flows should be spread over the second link.");
+
+  // Only the link that is left is used while the other is down; both are again once it comes back.
+  net.ports[1]->SetLinkUp (false);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (controller->LookupEqualCostRoutes (s, hosts[1], false, &ports), 1u, "Dead link should be left out.");
+  NS_TEST_ASSERT_MSG_EQ ((ports.size () == 1 && ports[0] == 2), true, "Link that is left should be used.");
+  net.ports[1]->SetLinkUp (true);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (controller->LookupEqualCostRoutes (s, hosts[1], false, &ports), 2u, "Link should be used again once it is up.");
+}
+
+class ProxyArpTestCase : public TestCase
+{
+public:
+  ProxyArpTestCase () : TestCase ("Proxy ARP test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+ProxyArpTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  Ipv4Address ips[2] = { Ipv4Address ("10.1.1.1"), Ipv4Address ("10.1.1.2") };
+  Ptr<ofi::LearningController> controller = CreateObject<ofi::LearningController> ();
+  controller->SetAttribute ("ProxyArp", BooleanValue (true));
+  TestNetwork net (controller, 2);
+
+  // The second host asks for an unknown address; the controller learns it and floods the request.
+  ArpHeader arp;
+  arp.SetRequest (hosts[1], ips[1], Mac48Address (), Ipv4Address ("10.1.1.9"));
+  Ptr<Packet> request = Create<Packet> ();
+  request->AddHeader (arp);
+  net.ports[1]->Receive (request, 0x0806, Mac48Address::GetBroadcast (), hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (net.ports[0]->m_sent.size (), 1u, "Request for an unknown address should be flooded.");
+
+  // Now the first host asks for the second; the controller answers and drops the request.
+  arp.SetRequest (hosts[0], ips[0], Mac48Address (), ips[1]);
+  request = Create<Packet> ();
+  request->AddHeader (arp);
+  net.ports[0]->Receive (request, 0x0806, Mac48Address::GetBroadcast (), hosts[0]);
+  Simulator::Run ();
+
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 0u, "Answered request should be dropped.");
+  NS_TEST_ASSERT_MSG_EQ (net.ports[0]->m_sent.size (), 2u, "Reply should go out of the ingress port.");
+  NS_TEST_ASSERT_MSG_EQ (net.ports[0]->m_protocols.back (), 0x0806, "Reply should be ARP.");
+  NS_TEST_ASSERT_MSG_EQ (net.ports[0]->m_dests.back (), hosts[0], "Reply should go to the requester.");
+  ArpHeader reply;
+  net.ports[0]->m_sent.back ()->PeekHeader (reply);
+  NS_TEST_ASSERT_MSG_EQ (reply.IsReply (), true, "Frame should be an ARP reply.");
+  NS_TEST_ASSERT_MSG_EQ (Mac48Address::ConvertFrom (reply.GetSourceHardwareAddress ()), hosts[1], "Reply should carry the target's address.");
+}
+
+class ProxyArpFloodTestCase : public TestCase
+{
+public:
+  ProxyArpFloodTestCase () : TestCase ("Proxy ARP flood test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+ProxyArpFloodTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  Ptr<ofi::LearningController> controller = CreateObject<ofi::LearningController> ();
+  controller->SetAttribute ("Proactive", BooleanValue (true));
+  controller->SetAttribute ("ProxyArp", BooleanValue (true));
+  TestNetwork net (controller, 2, MilliSeconds (1));
+  net.AddHosts (hosts, 2);
+  Simulator::Run ();
+
+  // The ARP flow sends the request up and the switch drops it, so the
+  // controller has to flood the frame it got instead of a buffer.
+  ArpHeader arp;
+  arp.SetRequest (hosts[1], Ipv4Address ("10.1.1.2"), Mac48Address (), Ipv4Address ("10.1.1.1"));
+  Ptr<Packet> request = Create<Packet> ();
+  request->AddHeader (arp);
+  net.ports[1]->Receive (request, 0x0806, Mac48Address::GetBroadcast (), hosts[1]);
+  Simulator::Run ();
+
+  NS_TEST_ASSERT_MSG_EQ (net.ports[0]->m_sent.size (), 1u, "Request should be flooded to the target.");
+  if (net.ports[0]->m_sent.size () == 1)
+    {
+      NS_TEST_ASSERT_MSG_EQ (net.ports[0]->m_protocols[0], 0x0806, "Flooded frame should be ARP.");
+      NS_TEST_ASSERT_MSG_EQ (net.ports[0]->m_dests[0], Mac48Address::GetBroadcast (), "Flooded frame should keep its destination.");
+      ArpHeader flooded;
+      net.ports[0]->m_sent[0]->PeekHeader (flooded);
+      NS_TEST_ASSERT_MSG_EQ (flooded.IsRequest (), true, "Flooded frame should be the request.");
+      NS_TEST_ASSERT_MSG_EQ (flooded.GetDestinationIpv4Address (), Ipv4Address ("10.1.1.1"), "Flooded request should ask for the target.");
+    }
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 0u, "Request should not go back to the requester.");
+}
+
+class ControlDelayTestCase : public TestCase
+{
+public:
+  ControlDelayTestCase () : TestCase ("Control delay test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+ControlDelayTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  TestNetwork net (CreateObject<ofi::LearningController> (), 2, MilliSeconds (5));
+  net.AddHosts (hosts, 2);
+
+  // The miss reaches the controller after one delay and its flow mod comes back
+  // after another; the next packet finds the flow already in the table.
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Schedule (MilliSeconds (20), &TestNetwork::Receive, &net, 0, hosts[0], hosts[1]);
+  Simulator::Run ();
+
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 2u, "Both packets should reach the destination port.");
+  if (net.ports[1]->m_sent.size () == 2)
+    {
+      NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_times[0], MilliSeconds (10), "Buffered packet should leave with the flow mod, a round trip later.");
+      NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_times[1], MilliSeconds (20), "Later packet should match the installed flow.");
+    }
+  NS_TEST_ASSERT_MSG_EQ (net.swtch->GetPacketIns (), 1u, "Only the first packet should miss.");
+}
+
+/// Controller that deletes an expiring flow and adds it back once, while the switch is still expiring it.
+class ReplacingController : public ofi::Controller
+{
+public:
+  ReplacingController () : m_expired (0)
+  {
+  }
+
+  virtual void ReceiveFromSwitch (Ptr<OpenFlowSwitchNetDevice> swtch, ofpbuf* buffer)
+  {
+    if (GetPacketType (buffer) != OFPT_FLOW_EXPIRED)
+      {
+        return;
+      }
+    if (m_expired++ == 0)
+      {
+        ofi::FlowSpec spec = m_spec;
+        spec.command = OFPFC_DELETE_STRICT;
+        swtch->InstallFlow (spec);
+        swtch->InstallFlow (m_spec);
+      }
+  }
+
+  ofi::FlowSpec m_spec;   ///< The flow.
+  uint32_t m_expired;     ///< Expiry notifications received.
+};
+
+class FlowExpiryTestCase : public TestCase
+{
+public:
+  FlowExpiryTestCase () : TestCase ("Flow expiry test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+FlowExpiryTestCase::DoRun (void)
+{
+  Mac48Address dst ("00:00:00:00:02:00");
+  Ptr<ReplacingController> controller = CreateObject<ReplacingController> ();
+  TestNetwork net (controller, 1);
+  OutputFlow add (dst, 0);
+  add.spec.hard_timeout = 1;
+  controller->m_spec = add.spec;
+  NS_TEST_ASSERT_MSG_EQ (net.swtch->InstallFlow (add.spec), 0, "Flow should be added.");
+
+  // The flow put back while the first one expires is left alone, and expires a second later.
+  sw_flow_key key = DestinationKey (dst);
+  Simulator::Stop (Seconds (1.5));
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (controller->m_expired, 1u, "First flow should have expired.");
+  NS_TEST_ASSERT_MSG_NE (chain_lookup (net.swtch->GetChain (), &key), 0, "Flow added back should stay.");
+
+  Simulator::Stop (Seconds (1.5));
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (controller->m_expired, 2u, "Flow added back should expire too.");
+  NS_TEST_ASSERT_MSG_EQ (chain_lookup (net.swtch->GetChain (), &key), 0, "Flow should be gone.");
+}
+
+/**
+ * \param swtch A switch.
+ * \param lookups Set to the lookups its flow tables made.
+ * \param matched Set to the lookups that found a flow.
+ */
+static void
+GetTableCounters (Ptr<OpenFlowSwitchNetDevice> swtch, unsigned long *lookups, unsigned long *matched)
+{
+  *lookups = *matched = 0;
+  for (int i = 0; i < swtch->GetChain ()->n_tables; i++)
+    {
+      *lookups += swtch->GetChain ()->tables[i]->n_lookup;
+      *matched += swtch->GetChain ()->tables[i]->n_matched;
+    }
+}
+
+class FlowCacheTestCase : public TestCase
+{
+public:
+  FlowCacheTestCase () : TestCase ("Flow cache test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+FlowCacheTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  TestNetwork net (CreateObject<RecordingController> (), 3);
+  Ptr<OpenFlowSwitchNetDevice> swtch = net.swtch;
+  swtch->SetAttribute ("FlowCacheSize", UintegerValue (64));
+  OutputFlow add (hosts[1], 1);
+  NS_TEST_ASSERT_MSG_EQ (swtch->InstallFlow (add.spec), 0, "Flow should be added.");
+
+  // The second packet of the flow hits the cache, and counts in the tables like the first.
+  unsigned long lookups, matched, firstLookups;
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetFlowCacheMisses (), 1u, "First packet should miss the cache.");
+  GetTableCounters (swtch, &firstLookups, &matched);
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetFlowCacheHits (), 1u, "Second packet should hit the cache.");
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 2u, "Both packets should follow the flow.");
+  GetTableCounters (swtch, &lookups, &matched);
+  NS_TEST_ASSERT_MSG_EQ (lookups, 2 * firstLookups, "Cache hit should count the table lookups.");
+  NS_TEST_ASSERT_MSG_EQ (matched, 2u, "Cache hit should count the match.");
+
+  // Adding a flow that takes over the packets invalidates the cache.
+  OutputFlow over (hosts[1], 2);
+  over.spec.priority = OFP_DEFAULT_PRIORITY + 1;
+  NS_TEST_ASSERT_MSG_EQ (swtch->InstallFlow (over.spec), 0, "Flow should be added.");
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetFlowCacheMisses (), 2u, "Packet should miss the cache after an add.");
+  NS_TEST_ASSERT_MSG_EQ (net.ports[2]->m_sent.size (), 1u, "Packet should follow the new flow.");
+
+  // So does modifying its actions.
+  OutputFlow modify (hosts[1], 1);
+  modify.spec.command = OFPFC_MODIFY;
+  NS_TEST_ASSERT_MSG_EQ (swtch->InstallFlow (modify.spec), 0, "Flows should be modified.");
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetFlowCacheMisses (), 3u, "Packet should miss the cache after a modify.");
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 3u, "Packet should follow the modified actions.");
+
+  // And deleting the flows.
+  OutputFlow del (hosts[1], 1);
+  del.spec.command = OFPFC_DELETE;
+  NS_TEST_ASSERT_MSG_EQ (swtch->InstallFlow (del.spec), 0, "Flows should be deleted.");
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetFlowCacheMisses (), 4u, "Packet should miss the cache after a delete.");
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetPacketIns (), 1u, "Packet should go to the controller.");
+
+  // And a flow expiring.
+  OutputFlow expiring (hosts[1], 1);
+  expiring.spec.hard_timeout = 1;
+  NS_TEST_ASSERT_MSG_EQ (swtch->InstallFlow (expiring.spec), 0, "Flow should be added.");
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 4u, "Packet should follow the flow before it expires.");
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetFlowCacheHits (), 1u, "Packet shouldn't hit the expired flow.");
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetPacketIns (), 2u, "Packet should go to the controller once the flow expired.");
+}
+
+class PacketBufferTestCase : public TestCase
+{
+public:
+  PacketBufferTestCase () : TestCase ("Packet buffer test case")
+  {
+  }
+
+private:
+  virtual void DoRun (void);
+};
+
+void
+PacketBufferTestCase::DoRun (void)
+{
+  Mac48Address hosts[2] = { Mac48Address ("00:00:00:00:02:00"), Mac48Address ("00:00:00:00:02:01") };
+  Ptr<RecordingController> controller = CreateObject<RecordingController> ();
+  TestNetwork net (controller, 2);
+  Ptr<OpenFlowSwitchNetDevice> swtch = net.swtch;
+  swtch->SetAttribute ("BufferSlotBits", UintegerValue (1));
+
+  // Two slots: the third miss evicts the oldest, which the controller holds by then.
+  for (int i = 0; i < 3; i++)
+    {
+      net.Receive (0, hosts[0], hosts[1]);
+      Simulator::Run ();
+    }
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetNBuffers (), 2u, "Buffer store should have two slots.");
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetBufferEvictions (), 1u, "Third packet should evict the first.");
+  NS_TEST_ASSERT_MSG_EQ (controller->m_bufferIds.size (), 3u, "Every miss should reach the controller.");
+  if (controller->m_bufferIds.size () != 3)
+    {
+      return;
+    }
+
+  // Dropping a packet frees its slot for the next one; its id doesn't come back.
+  std::vector<uint32_t> ids = controller->m_bufferIds;
+  NS_TEST_ASSERT_MSG_EQ (swtch->SendPacketOut (ids[0], 0, 0, 0), -ESRCH, "Evicted packet should be gone.");
+  NS_TEST_ASSERT_MSG_EQ (swtch->SendPacketOut (ids[1], 0, 0, 0), 0, "Buffered packet should be dropped.");
+  net.Receive (0, hosts[0], hosts[1]);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (swtch->GetBufferEvictions (), 1u, "Freed slot should take the packet.");
+  NS_TEST_ASSERT_MSG_EQ (swtch->SendPacketOut (ids[1], 0, 0, 0), -ESRCH, "Dropped packet's id should stay unused.");
+
+  // A packet out to OFPP_TABLE keeps the packet for the lookup it queues.
+  OutputFlow add (hosts[1], 1);
+  NS_TEST_ASSERT_MSG_EQ (swtch->InstallFlow (add.spec), 0, "Flow should be added.");
+  ofp_action_output x = add.action;
+  x.port = OFPP_TABLE;
+  NS_TEST_ASSERT_MSG_EQ (swtch->SendPacketOut (ids[2], 0, (ofp_action_header*)&x, sizeof(x)), 0, "Packet out should run.");
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (net.ports[1]->m_sent.size (), 1u, "Resubmitted packet should match the flow.");
+  NS_TEST_ASSERT_MSG_EQ (swtch->SendPacketOut (ids[2], 0, 0, 0), -ESRCH, "Lookup should drop the packet when done.");
+}
+
 class SwitchTestSuite : public TestSuite
 {
 public:
@@ -182,6 +1806,31 @@ public:
 SwitchTestSuite::SwitchTestSuite () : TestSuite ("openflow", UNIT)
 {
   AddTestCase (new SwitchFlowTableTestCase, TestCase::QUICK);
+  AddTestCase (new TupleSpaceTableTestCase, TestCase::QUICK);
+  AddTestCase (new ActionProgramTestCase, TestCase::QUICK);
+  AddTestCase (new FlowTimerWheelTestCase, TestCase::QUICK);
+  AddTestCase (new ControlLinkTestCase, TestCase::QUICK);
+  AddTestCase (new ControllerQueueTestCase, TestCase::QUICK);
+  AddTestCase (new PortStatusTestCase, TestCase::QUICK);
+  AddTestCase (new PendingMissTestCase, TestCase::QUICK);
+  AddTestCase (new PacketInMeterTestCase, TestCase::QUICK);
+  AddTestCase (new VendorStatsTestCase, TestCase::QUICK);
+  AddTestCase (new LearningControllerRouteTestCase, TestCase::QUICK);
+  AddTestCase (new ProactiveRoutesTestCase, TestCase::QUICK);
+  AddTestCase (new ProactivePlanesTestCase, TestCase::QUICK);
+  AddTestCase (new NativeControlTestCase, TestCase::QUICK);
+  AddTestCase (new LinkDownTestCase, TestCase::QUICK);
+  AddTestCase (new AggregatedFlowTestCase, TestCase::QUICK);
+  AddTestCase (new LostFlowTestCase, TestCase::QUICK);
+  AddTestCase (new FloodFlowTestCase, TestCase::QUICK);
+  AddTestCase (new FloodTreeTestCase, TestCase::QUICK);
+  AddTestCase (new EqualCostTestCase, TestCase::QUICK);
+  AddTestCase (new ProxyArpTestCase, TestCase::QUICK);
+  AddTestCase (new ProxyArpFloodTestCase, TestCase::QUICK);
+  AddTestCase (new ControlDelayTestCase, TestCase::QUICK);
+  AddTestCase (new FlowExpiryTestCase, TestCase::QUICK);
+  AddTestCase (new FlowCacheTestCase, TestCase::QUICK);
+  AddTestCase (new PacketBufferTestCase, TestCase::QUICK);
 }
 
 // Do not forget to allocate an instance of this TestSuite